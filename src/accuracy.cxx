@@ -0,0 +1,137 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <numbers>
+#include <string>
+#include <string_view>
+
+#include "earth_texture.hxx"
+#include "projection.hxx"
+#include "image_creator.hxx"
+#include "parallel.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    char const * get_option(char const * name, char const * default_value, int argc, char const * argv[])
+    {
+      for (int i = 1; i < argc - 1; ++i)
+	if (std::strcmp(argv[i], name) == 0)
+	  return argv[i + 1];
+      return default_value;
+    }
+
+    // Prints, for every non-separable projection and a few output widths,
+    // how many pixels the adaptive grid inverts and the largest texel
+    // difference from the exact inverse.
+    int check_approximation(earth_texture const & texture, projection_parameters const & parameters, double approximation, std::size_t tolerance, std::size_t threads)
+    {
+      int status = 0;
+      std::cout << "projection,width,inversions,pixels,max_texel_difference\n";
+      for (std::string_view name : projection_names()) {
+	std::unique_ptr<projection> exact = make_projection(name, parameters);
+	if (exact->separable())
+	  continue;
+	for (std::size_t width : { 256, 1024, 4096 }) {
+	  image_creator creator { texture, *exact, width, 0.0, false, threads };
+	  creator.set_approximation(approximation);
+	  image_creator::approximation_error error = creator.measure_approximation();
+	  std::cout << name << ',' << width << ',' << error.inversions << ',' << error.pixels << ',';
+	  if (error.max_texel_difference == static_cast<std::size_t>(-1))
+	    std::cout << "coverage\n";
+	  else
+	    std::cout << error.max_texel_difference << '\n';
+	  if (error.max_texel_difference > tolerance)
+	    status = 1;
+	}
+      }
+      return status;
+    }
+
+    // Prints, for every projection and a few output widths, how many
+    // Newton steps the inverse took per pixel and how many pixels failed
+    // to converge.  Projections with a closed-form inverse report no
+    // solves.  The status is 1 when any pixel on the map failed.
+    int check_iterations(earth_texture const & texture, projection_parameters const & parameters, std::size_t threads)
+    {
+      int status = 0;
+      std::cout << "projection,width,solves,mean_iterations,max_iterations,failures\n";
+      for (std::string_view name : projection_names()) {
+	std::unique_ptr<projection> exact = make_projection(name, parameters);
+	for (std::size_t width : { 256, 1024, 4096 }) {
+	  image_creator creator { texture, *exact, width, 0.0, false, threads };
+	  inverse_statistics statistics = creator.measure_iterations();
+	  std::cout << name << ',' << width << ',' << statistics.solves << ','
+		    << (statistics.solves ? static_cast<double>(statistics.iterations) / statistics.solves : 0.0) << ','
+		    << statistics.max_iterations << ',' << statistics.failures << '\n';
+	  if (statistics.failures > 0)
+	    status = 1;
+	}
+      }
+      return status;
+    }
+  }
+
+}
+
+// Prints, for every projection and a few output widths, the largest
+// texel-index difference between the double and the fast-math inverse
+// over every pixel.  "coverage" means the two disagree about which pixels
+// are inside the map.  With --approximate, checks the adaptive-grid
+// inverse with that tolerance instead, allowing by default a difference of
+// the tolerance rounded up, and with --iterations, reports the
+// cost of the iterative inverses.  --center-latitude and --rotation, in
+// degrees, give the aspect of every check.  The status is 1 when any
+// difference exceeds --tolerance.
+int main(int argc, char const * argv[])
+{
+  using namespace mkworldmap;
+  earth_texture texture { get_option("--texture", "./res/world.topo.bathy.200412.3x5400x2700.jpg", argc, argv) };
+  if (!texture) {
+    std::cerr << "ERROR: failed to load a texture." << std::endl;
+    return 1;
+  }
+  std::size_t threads = default_thread_count();
+  projection_parameters parameters {
+    .center_latitude = std::atof(get_option("--center-latitude", "0", argc, argv)) * std::numbers::pi / 180,
+    .rotation = std::atof(get_option("--rotation", "0", argc, argv)) * std::numbers::pi / 180
+  };
+  if (char const * approximation = get_option("--approximate", nullptr, argc, argv)) {
+    // A point off by less than the approximation moves its texel index by
+    // at most the approximation rounded up.
+    std::size_t bound = std::max(1.0, std::ceil(std::atof(approximation)));
+    std::size_t tolerance = std::atoi(get_option("--tolerance", std::to_string(bound).c_str(), argc, argv));
+    return check_approximation(texture, parameters, std::atof(approximation), tolerance, threads);
+  }
+  std::size_t tolerance = std::atoi(get_option("--tolerance", "1", argc, argv));
+  for (int i = 1; i < argc; ++i)
+    if (std::strcmp(argv[i], "--iterations") == 0)
+      return check_iterations(texture, parameters, threads);
+
+  projection_parameters fast_parameters = parameters;
+  fast_parameters.fast_math = true;
+
+  int status = 0;
+  std::cout << "projection,width,fast_path,max_texel_difference\n";
+  for (std::string_view name : projection_names()) {
+    std::unique_ptr<projection> exact = make_projection(name, parameters);
+    std::unique_ptr<projection> fast = make_projection(name, fast_parameters);
+    for (std::size_t width : { 256, 1024, 4096 }) {
+      image_creator creator { texture, *exact, width, 0.0, false, threads };
+      std::size_t difference = creator.max_texel_difference(*fast);
+      std::cout << name << ',' << width << ',' << (fast->fast_math() ? "yes" : "no") << ',';
+      if (difference == static_cast<std::size_t>(-1))
+	std::cout << "coverage\n";
+      else
+	std::cout << difference << '\n';
+      if (difference > tolerance)
+	status = 1;
+    }
+  }
+  return status;
+}
@@ -0,0 +1,261 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <numbers>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "earth_texture.hxx"
+#include "projection.hxx"
+#include "image_creator.hxx"
+#include "image_writer.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    struct bench_result
+    {
+      std::string name;
+      double ns_per_pixel;
+    };
+
+    std::size_t constexpr grid_width = 1024;
+    std::size_t constexpr grid_height = 512;
+    std::size_t constexpr repetitions = 5;
+    double constexpr min_seconds = 0.05;
+
+    char const * get_option(char const * name, char const * default_value, int argc, char const * argv[])
+    {
+      for (int i = 1; i < argc - 1; ++i)
+	if (std::strcmp(argv[i], name) == 0)
+	  return argv[i + 1];
+      return default_value;
+    }
+
+    // Runs f until at least min_seconds have passed, takes the fastest of
+    // several such runs, and divides by the number of pixels f touches.
+    double measure(std::size_t pixels, std::function<void()> const & f)
+    {
+      f();
+      double best = INFINITY;
+      for (std::size_t r = 0; r < repetitions; ++r) {
+	std::size_t iterations = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed;
+	do {
+	  f();
+	  ++iterations;
+	  elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < min_seconds);
+	best = std::min(best, elapsed.count() * 1e9 / (iterations * pixels));
+      }
+      return best;
+    }
+
+    std::vector<double> projected_xs(projection const & proj)
+    {
+      std::vector<double> xs(grid_width);
+      for (std::size_t x = 0; x < grid_width; ++x)
+	xs[x] = proj.x_min + proj.width() * (x + 0.5) / grid_width;
+      return xs;
+    }
+
+    double projected_y(projection const & proj, std::size_t y)
+    {
+      return proj.y_min + proj.height() * (y + 0.5) / grid_height;
+    }
+
+    void bench_projections(std::vector<bench_result> & results)
+    {
+      std::vector<point> row(grid_width);
+      double volatile sink;
+      for (std::string_view name : projection_names()) {
+	std::unique_ptr<projection> proj = make_projection(name);
+	std::vector<double> xs = projected_xs(*proj);
+	results.push_back({ "invert/" + std::string { name }, measure(grid_width * grid_height, [&] {
+	  double sum = 0;
+	  for (std::size_t y = 0; y < grid_height; ++y) {
+	    double py = projected_y(*proj, y);
+	    for (double px : xs)
+	      sum += proj->invert(px, py).x;
+	  }
+	  sink = sum;
+	}) });
+	results.push_back({ "invert_many/" + std::string { name }, measure(grid_width * grid_height, [&] {
+	  for (std::size_t y = 0; y < grid_height; ++y)
+	    proj->invert_many(xs, projected_y(*proj, y), row);
+	  sink = row[0].x;
+	}) });
+	std::unique_ptr<projection> fast = make_projection(name, projection_parameters { .fast_math = true });
+	if (fast->fast_math()) {
+	  results.push_back({ "invert_many_fast/" + std::string { name }, measure(grid_width * grid_height, [&] {
+	    for (std::size_t y = 0; y < grid_height; ++y)
+	      fast->invert_many(xs, projected_y(*fast, y), row);
+	    sink = row[0].x;
+	  }) });
+	}
+      }
+    }
+
+    void bench_texture(earth_texture const & texture, std::vector<bench_result> & results)
+    {
+      std::size_t constexpr samples = grid_width * grid_height;
+      std::vector<point> sequential(samples);
+      for (std::size_t y = 0; y < grid_height; ++y)
+	for (std::size_t x = 0; x < grid_width; ++x)
+	  sequential[y * grid_width + x] = {
+	    -std::numbers::pi + 2 * std::numbers::pi * (x + 0.5) / grid_width,
+	    std::numbers::pi * 0.5 - std::numbers::pi * (y + 0.5) / grid_height
+	  };
+      std::vector<point> scattered = sequential;
+      std::uint64_t state = 0x9e3779b97f4a7c15;
+      for (std::size_t i = samples - 1; i > 0; --i) {
+	state = state * 6364136223846793005 + 1442695040888963407;
+	std::swap(scattered[i], scattered[(state >> 33) % (i + 1)]);
+      }
+
+      char unsigned volatile sink;
+      for (auto [name, points] : { std::pair { "color_at/sequential", &sequential }, std::pair { "color_at/scattered", &scattered } }) {
+	results.push_back({ name, measure(samples, [&] {
+	  char unsigned sum = 0;
+	  for (point p : *points)
+	    sum += texture.color_at(p.x, p.y).green;
+	  sink = sum;
+	}) });
+      }
+    }
+
+    void bench_pipeline(earth_texture const & texture, std::size_t threads, std::vector<bench_result> & results)
+    {
+      for (char const * name : { "equirectangular", "mollweide", "orthographic" }) {
+	std::unique_ptr<projection> proj = make_projection(name);
+	for (std::size_t width : { 256, 1024, 4096 }) {
+	  image_creator creator { texture, *proj, width, 0.0, false, threads };
+	  std::size_t pixels = creator.image_width() * creator.image_height();
+	  std::unique_ptr<char unsigned[]> buffer = std::make_unique<char unsigned[]>(pixels * 3);
+	  results.push_back({ std::string { "render/" } + name + '/' + std::to_string(width), measure(pixels, [&] {
+	    creator.render(buffer.get());
+	  }) });
+	}
+      }
+    }
+
+    void bench_encode(earth_texture const & texture, std::size_t threads, std::vector<bench_result> & results)
+    {
+      std::unique_ptr<projection> proj = make_projection("equirectangular");
+      image_creator creator { texture, *proj, 1024, 0.0 };
+      std::size_t pixels = creator.image_width() * creator.image_height();
+      std::unique_ptr<char unsigned[]> buffer = std::make_unique<char unsigned[]>(pixels * 3);
+      creator.render(buffer.get());
+      std::pair<char const *, image_options> formats[] = {
+	{ "encode/jpeg/1024", image_options { .format = image_format::jpeg, .threads = threads } },
+	{ "encode/png/1024", image_options { .format = image_format::png, .png_level = 1 } },
+	{ "encode/ppm/1024", image_options { .format = image_format::ppm } },
+	{ "encode/qoi/1024", image_options { .format = image_format::qoi } }
+      };
+      for (auto const & [name, options] : formats) {
+	results.push_back({ name, measure(pixels, [&] {
+	  std::unique_ptr<image_writer> writer = make_image_writer("/dev/null", creator.image_width(), creator.image_height(), options);
+	  writer->write_rows(buffer.get(), creator.image_height());
+	  writer->finish();
+	}) });
+      }
+    }
+
+    void write_csv(std::ostream & out, std::vector<bench_result> const & results)
+    {
+      out << "name,ns_per_pixel\n";
+      for (bench_result const & r : results)
+	out << r.name << ',' << r.ns_per_pixel << '\n';
+    }
+
+    void write_json(std::ostream & out, std::vector<bench_result> const & results)
+    {
+      out << "[\n";
+      for (std::size_t i = 0; i < results.size(); ++i)
+	out << "  { \"name\": \"" << results[i].name << "\", \"ns_per_pixel\": " << results[i].ns_per_pixel << " }"
+	    << (i + 1 < results.size() ? ",\n" : "\n");
+      out << "]\n";
+    }
+
+    bool read_baseline(std::string const & path, std::map<std::string, double> & baseline)
+    {
+      std::ifstream in { path };
+      if (!in)
+	return false;
+      std::string line;
+      std::getline(in, line);
+      while (std::getline(in, line)) {
+	std::size_t comma = line.find(',');
+	if (comma != std::string::npos)
+	  baseline[line.substr(0, comma)] = std::atof(line.c_str() + comma + 1);
+      }
+      return true;
+    }
+  }
+
+}
+
+int main(int argc, char const * argv[])
+{
+  using namespace mkworldmap;
+  earth_texture texture { get_option("--texture", "./res/world.topo.bathy.200412.3x5400x2700.jpg", argc, argv) };
+  if (!texture) {
+    std::cerr << "ERROR: failed to load a texture." << std::endl;
+    return 1;
+  }
+  std::size_t threads = std::max(1, std::atoi(get_option("--threads", "1", argc, argv)));
+
+  std::vector<bench_result> results;
+  bench_projections(results);
+  bench_texture(texture, results);
+  bench_pipeline(texture, threads, results);
+  bench_encode(texture, threads, results);
+
+  std::ostringstream report;
+  report.precision(4);
+  if (std::strcmp(get_option("--format", "csv", argc, argv), "json") == 0)
+    write_json(report, results);
+  else
+    write_csv(report, results);
+  char const * output_path = get_option("--output", nullptr, argc, argv);
+  if (output_path) {
+    std::ofstream out { output_path };
+    if (!(out << report.str())) {
+      std::cerr << "ERROR: failed to write results." << std::endl;
+      return 1;
+    }
+  } else {
+    std::cout << report.str();
+  }
+
+  char const * baseline_path = get_option("--baseline", nullptr, argc, argv);
+  if (!baseline_path)
+    return 0;
+  std::map<std::string, double> baseline;
+  if (!read_baseline(baseline_path, baseline)) {
+    std::cerr << "ERROR: failed to read a baseline." << std::endl;
+    return 1;
+  }
+  double tolerance = std::atof(get_option("--tolerance", "0.25", argc, argv));
+  int status = 0;
+  for (bench_result const & r : results) {
+    auto it = baseline.find(r.name);
+    if (it != baseline.end() && r.ns_per_pixel > it->second * (1 + tolerance)) {
+      std::cerr << "REGRESSION: " << r.name << ' ' << it->second << " -> " << r.ns_per_pixel << " ns/pixel" << std::endl;
+      status = 1;
+    }
+  }
+  return status;
+}
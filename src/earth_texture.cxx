@@ -1,12 +1,243 @@
 
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#include <jpeglib.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "earth_texture.hxx"
 #include "util.hxx"
 
 namespace mkworldmap
 {
+
+  namespace
+  {
+    struct texture_cache_header
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t channels;
+      std::uint32_t width;
+      std::uint32_t height;
+      std::uint64_t source_size;
+      std::int64_t source_mtime_sec;
+      std::int64_t source_mtime_nsec;
+      std::uint64_t data_offset;
+      // The source path follows the header.
+      std::uint64_t source_path_size;
+    };
+
+    char constexpr texture_cache_magic[8] = { 'M', 'K', 'W', 'M', 'T', 'E', 'X', '\0' };
+    std::uint32_t constexpr texture_cache_version = 2;
+    std::uint64_t constexpr texture_cache_alignment = 4096;
+
+    // FNV-1a, which unlike std::hash gives the same cache file name with
+    // every build.
+    std::uint64_t path_hash(std::string const & path)
+    {
+      std::uint64_t hash = 0xcbf29ce484222325;
+      for (char c : path) {
+	hash ^= static_cast<char unsigned>(c);
+	hash *= 0x100000001b3;
+      }
+      return hash;
+    }
+
+    std::string texture_cache_path(std::string const & path, std::string const & cache_directory)
+    {
+      std::ostringstream cache_path;
+      std::size_t slash = path.find_last_of('/');
+      cache_path << cache_directory << '/'
+		 << (slash == std::string::npos ? path : path.substr(slash + 1))
+		 << '.' << std::hex << path_hash(path)
+		 << ".texture";
+      return cache_path.str();
+    }
+
+    bool matches_source(texture_cache_header const & header, struct stat const & source, std::string const & path)
+    {
+      return std::memcmp(header.magic, texture_cache_magic, sizeof header.magic) == 0
+	&& header.version == texture_cache_version
+	&& header.channels == 3
+	&& header.data_offset == texture_cache_alignment
+	&& header.source_size == static_cast<std::uint64_t>(source.st_size)
+	&& header.source_mtime_sec == source.st_mtim.tv_sec
+	&& header.source_mtime_nsec == source.st_mtim.tv_nsec
+	&& header.source_path_size == path.size();
+    }
+
+    // Two sources whose names collide in the cache file name are told
+    // apart by the full path stored after the header.
+    bool names_source(int fd, std::string const & path)
+    {
+      std::string stored(path.size(), '\0');
+      return ::pread(fd, stored.data(), stored.size(), sizeof(texture_cache_header)) == static_cast<ssize_t>(stored.size())
+	&& stored == path;
+    }
+
+    struct jpeg_error_manager
+    {
+      jpeg_error_mgr manager;
+      std::jmp_buf jump_buffer;
+    };
+
+    void jpeg_error_exit(j_common_ptr cinfo)
+    {
+      std::longjmp(reinterpret_cast<jpeg_error_manager *>(cinfo->err)->jump_buffer, 1);
+    }
+
+    // Every step that can fail sets its own jump point, so no local state
+    // is live across a longjmp.
+    class jpeg_reader
+    {
+      std::FILE * file;
+      jpeg_decompress_struct cinfo;
+      jpeg_error_manager error;
+      bool failed = false;
+
+    public:
+      jpeg_reader() = delete;
+      jpeg_reader(jpeg_reader const &) = delete;
+      jpeg_reader(jpeg_reader &&) = delete;
+      jpeg_reader & operator=(jpeg_reader const &) = delete;
+      jpeg_reader & operator=(jpeg_reader &&) = delete;
+      jpeg_reader(std::FILE *);
+      ~jpeg_reader();
+
+      std::size_t width() const;
+      std::size_t height() const;
+      bool start(unsigned);
+      bool crop(std::size_t &, std::size_t &);
+      bool skip_rows(std::size_t);
+      bool read_rows(char unsigned *, std::size_t);
+
+      explicit operator bool() const;
+    };
+
+    jpeg_reader::jpeg_reader(std::FILE * file)
+      : file { file }
+    {
+      cinfo.err = jpeg_std_error(&error.manager);
+      error.manager.error_exit = jpeg_error_exit;
+      jpeg_create_decompress(&cinfo);
+      if (setjmp(error.jump_buffer)) {
+	failed = true;
+	return;
+      }
+      jpeg_stdio_src(&cinfo, file);
+      jpeg_read_header(&cinfo, TRUE);
+      cinfo.out_color_space = JCS_RGB;
+    }
+
+    jpeg_reader::~jpeg_reader()
+    {
+      jpeg_destroy_decompress(&cinfo);
+      std::fclose(file);
+    }
+
+    // The image size, which is the source size until start() scales it and
+    // crop() narrows it.
+    std::size_t jpeg_reader::width() const
+    {
+      return cinfo.output_width == 0 ? cinfo.image_width : cinfo.output_width;
+    }
+
+    std::size_t jpeg_reader::height() const
+    {
+      return cinfo.output_height == 0 ? cinfo.image_height : cinfo.output_height;
+    }
+
+    // Decodes at 1/denominator of the source size, which libjpeg does in
+    // the DCT domain for 2, 4 and 8.
+    bool jpeg_reader::start(unsigned denominator)
+    {
+      if (failed)
+	return false;
+      if (setjmp(error.jump_buffer)) {
+	failed = true;
+	return false;
+      }
+      cinfo.scale_num = 1;
+      cinfo.scale_denom = denominator;
+      jpeg_start_decompress(&cinfo);
+      return cinfo.output_components == 3;
+    }
+
+    // Narrows the columns to at least [offset, offset + count).  libjpeg
+    // moves the start back to an iMCU boundary and reports the real range.
+    bool jpeg_reader::crop(std::size_t & offset, std::size_t & count)
+    {
+      if (failed)
+	return false;
+#ifdef LIBJPEG_TURBO_VERSION
+      if (setjmp(error.jump_buffer)) {
+	failed = true;
+	return false;
+      }
+      JDIMENSION x = offset;
+      JDIMENSION w = count;
+      jpeg_crop_scanline(&cinfo, &x, &w);
+      offset = x;
+      count = w;
+#else
+      offset = 0;
+      count = cinfo.output_width;
+#endif
+      return true;
+    }
+
+    bool jpeg_reader::skip_rows(std::size_t count)
+    {
+      if (failed)
+	return false;
+      if (setjmp(error.jump_buffer)) {
+	failed = true;
+	return false;
+      }
+#ifdef LIBJPEG_TURBO_VERSION
+      jpeg_skip_scanlines(&cinfo, count);
+#else
+      std::vector<JSAMPLE> row(std::size_t { cinfo.output_width } * 3);
+      JSAMPROW rows[] = { row.data() };
+      for (std::size_t i = 0; i < count; ++i)
+	jpeg_read_scanlines(&cinfo, rows, 1);
+#endif
+      return true;
+    }
+
+    bool jpeg_reader::read_rows(char unsigned * buffer, std::size_t count)
+    {
+      if (failed)
+	return false;
+      if (setjmp(error.jump_buffer)) {
+	failed = true;
+	return false;
+      }
+      std::size_t stride = std::size_t { cinfo.output_width } * 3;
+      for (std::size_t i = 0; i < count; ) {
+	JSAMPROW row = buffer + i * stride;
+	i += jpeg_read_scanlines(&cinfo, &row, 1);
+      }
+      return true;
+    }
+
+    jpeg_reader::operator bool() const
+    {
+      return !failed;
+    }
+  }
   
   earth_texture::earth_texture(std::string const & path)
   {
@@ -17,10 +248,301 @@ namespace mkworldmap
     buffer = std::shared_ptr<char unsigned[]> { raw_buffer, stbi_image_free };
   }
 
+  earth_texture::earth_texture(std::string const & path, std::string const & cache_directory)
+  {
+    std::string cache_path = texture_cache_path(path, cache_directory);
+    if (load_cache(path, cache_path))
+      return;
+    *this = earth_texture { path };
+    if (buffer)
+      save_cache(path, cache_path);
+  }
+
+  // Falls back to the full stb_image decode when the region asks for
+  // nothing less or the file is not a JPEG that libjpeg can read.
+  earth_texture::earth_texture(std::string const & path, texture_region const & region)
+  {
+    texture_region constexpr whole { };
+    bool reduced = region.resolution > 0
+      || region.longitude_min > whole.longitude_min || region.longitude_max < whole.longitude_max
+      || region.latitude_min > whole.latitude_min || region.latitude_max < whole.latitude_max;
+    if (!reduced || !load_jpeg(path, region))
+      *this = earth_texture { path };
+  }
+
+  bool earth_texture::load_cache(std::string const & path, std::string const & cache_path)
+  {
+    struct stat source;
+    if (::stat(path.c_str(), &source) != 0)
+      return false;
+    int fd = ::open(cache_path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    texture_cache_header header;
+    struct stat cache;
+    if (::pread(fd, &header, sizeof header, 0) != sizeof header
+	|| !matches_source(header, source, path)
+	|| !names_source(fd, path)
+	|| ::fstat(fd, &cache) != 0
+	|| static_cast<std::uint64_t>(cache.st_size) != header.data_offset + std::uint64_t { header.width } * header.height * 3) {
+      ::close(fd);
+      return false;
+    }
+    std::size_t size = cache.st_size;
+    void * mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+      return false;
+    ::madvise(mapped, size, MADV_WILLNEED);
+
+    width = header.width;
+    height = header.height;
+    buffer = std::shared_ptr<char unsigned[]> {
+      static_cast<char unsigned *>(mapped) + header.data_offset,
+      [mapped, size](char unsigned *) { ::munmap(mapped, size); }
+    };
+    return true;
+  }
+
+  bool earth_texture::save_cache(std::string const & path, std::string const & cache_path) const
+  {
+    struct stat source;
+    if (::stat(path.c_str(), &source) != 0 || sizeof(texture_cache_header) + path.size() > texture_cache_alignment)
+      return false;
+    texture_cache_header header { };
+    std::memcpy(header.magic, texture_cache_magic, sizeof header.magic);
+    header.version = texture_cache_version;
+    header.channels = 3;
+    header.width = width;
+    header.height = height;
+    header.source_size = source.st_size;
+    header.source_mtime_sec = source.st_mtim.tv_sec;
+    header.source_mtime_nsec = source.st_mtim.tv_nsec;
+    header.data_offset = texture_cache_alignment;
+    header.source_path_size = path.size();
+
+    std::string temporary_path = cache_path + ".tmp" + std::to_string(::getpid());
+    {
+      std::ofstream out { temporary_path, std::ios::binary };
+      out.write(reinterpret_cast<char const *>(&header), sizeof header);
+      out.write(path.data(), path.size());
+      out.seekp(header.data_offset);
+      out.write(reinterpret_cast<char const *>(buffer.get()), std::size_t { header.width } * header.height * 3);
+      if (!out) {
+	out.close();
+	std::remove(temporary_path.c_str());
+	return false;
+      }
+    }
+    return std::rename(temporary_path.c_str(), cache_path.c_str()) == 0;
+  }
+
+  // Picks the coarsest DCT scale whose texels are no larger than the
+  // region's resolution, then decodes only the rows and columns that cover
+  // the region.  The bounds are moved out to the decoded texel centers so
+  // that grid_x and grid_y keep addressing the same texels.
+  bool earth_texture::load_jpeg(std::string const & path, texture_region const & region)
+  {
+    std::FILE * file = std::fopen(path.c_str(), "rb");
+    if (!file)
+      return false;
+    jpeg_reader reader { file };
+    if (!reader || reader.width() < 2 || reader.height() < 2)
+      return false;
+
+    double constexpr pi = std::numbers::pi;
+    double texel = std::max(2 * pi / reader.width(), pi / reader.height());
+    unsigned denominator = 1;
+    while (denominator < 8 && 2 * denominator * texel <= region.resolution)
+      denominator *= 2;
+    if (!reader.start(denominator))
+      return false;
+
+    std::size_t full_width = reader.width();
+    std::size_t full_height = reader.height();
+    if (full_width < 2 || full_height < 2)
+      return false;
+    double x_scale = (full_width - 1) / (2 * pi);
+    double y_scale = (full_height - 1) / pi;
+    auto first = [](double position, std::size_t size) {
+      return std::min(static_cast<std::size_t>(std::max(0.0, std::floor(position))), size - 2);
+    };
+    auto last = [](double position, std::size_t size) {
+      return std::min(static_cast<std::size_t>(std::max(0.0, std::ceil(position))), size - 1);
+    };
+    std::size_t x_begin = first((region.longitude_min + pi) * x_scale, full_width);
+    std::size_t x_count = std::max(last((region.longitude_max + pi) * x_scale, full_width), x_begin + 1) - x_begin + 1;
+    std::size_t y_begin = first((pi * 0.5 - region.latitude_max) * y_scale, full_height);
+    std::size_t y_count = std::max(last((pi * 0.5 - region.latitude_min) * y_scale, full_height), y_begin + 1) - y_begin + 1;
+    if (x_count < full_width && !reader.crop(x_begin, x_count))
+      return false;
+
+    auto decoded = std::make_shared<char unsigned[]>(x_count * y_count * 3);
+    if (!reader.skip_rows(y_begin) || !reader.read_rows(decoded.get(), y_count))
+      return false;
+
+    width = x_count;
+    height = y_count;
+    buffer = std::move(decoded);
+    cacheable = false;
+    if (x_count < full_width) {
+      longitude_min = -pi + x_begin / x_scale;
+      longitude_max = -pi + (x_begin + x_count - 1) / x_scale;
+    }
+    if (y_count < full_height) {
+      latitude_max = pi * 0.5 - y_begin / y_scale;
+      latitude_min = pi * 0.5 - (y_begin + y_count - 1) / y_scale;
+    }
+    return true;
+  }
+
+  int earth_texture::grid_width() const
+  {
+    return width;
+  }
+
+  int earth_texture::grid_height() const
+  {
+    return height;
+  }
+
+  texture_layout earth_texture::grid_layout() const
+  {
+    return layout;
+  }
+
+  double earth_texture::longitude_span() const
+  {
+    return longitude_max - longitude_min;
+  }
+
+  double earth_texture::latitude_span() const
+  {
+    return latitude_max - latitude_min;
+  }
+
+  std::size_t earth_texture::grid_x(double x) const
+  {
+    x = clamp(x, longitude_min, longitude_max);
+    double nx = (x - longitude_min) * (width - 1) / (longitude_max - longitude_min);
+    return static_cast<std::size_t>(nx);
+  }
+
+  std::size_t earth_texture::grid_y(double y) const
+  {
+    y = clamp(y, latitude_min, latitude_max);
+    double ny = (y - latitude_min) * (height - 1) / (latitude_max - latitude_min);
+    return height - static_cast<std::size_t>(ny) - 1;
+  }
+
+  earth_texture earth_texture::tiled() const
+  {
+    if (!buffer || layout == texture_layout::tiled)
+      return *this;
+    earth_texture result { *this };
+    result.layout = texture_layout::tiled;
+    result.tiles_per_row = (width + tile_size - 1) / tile_size;
+    std::size_t tile_rows = (height + tile_size - 1) / tile_size;
+    result.buffer = std::make_shared<char unsigned[]>(result.tiles_per_row * tile_rows * tile_size * tile_size * 4);
+    for (std::size_t y = 0; y < static_cast<std::size_t>(height); ++y) {
+      for (std::size_t x = 0; x < static_cast<std::size_t>(width); ++x) {
+	char unsigned const * source = &buffer[(y * width + x) * 3];
+	char unsigned * destination = &result.buffer[result.texel_index_at_grid(x, y) * 4];
+	std::copy(source, source + 3, destination);
+      }
+    }
+    return result;
+  }
+
+  earth_texture earth_texture::downsampled() const
+  {
+    earth_texture result;
+    result.longitude_min = longitude_min;
+    result.longitude_max = longitude_max;
+    result.latitude_min = latitude_min;
+    result.latitude_max = latitude_max;
+    result.cacheable = cacheable;
+    result.width = std::max(1, (width + 1) / 2);
+    result.height = std::max(1, (height + 1) / 2);
+    result.buffer = std::make_shared<char unsigned[]>(static_cast<std::size_t>(result.width) * result.height * 3);
+    for (std::size_t y = 0; y < static_cast<std::size_t>(result.height); ++y) {
+      std::size_t y0 = std::min<std::size_t>(2 * y, height - 1);
+      std::size_t y1 = std::min<std::size_t>(2 * y + 1, height - 1);
+      for (std::size_t x = 0; x < static_cast<std::size_t>(result.width); ++x) {
+	std::size_t x0 = std::min<std::size_t>(2 * x, width - 1);
+	std::size_t x1 = std::min<std::size_t>(2 * x + 1, width - 1);
+	color c[] = { color_at_grid(x0, y0), color_at_grid(x1, y0), color_at_grid(x0, y1), color_at_grid(x1, y1) };
+	char unsigned * destination = &result.buffer[(y * result.width + x) * 3];
+	destination[0] = (c[0].red + c[1].red + c[2].red + c[3].red + 2) / 4;
+	destination[1] = (c[0].green + c[1].green + c[2].green + c[3].green + 2) / 4;
+	destination[2] = (c[0].blue + c[1].blue + c[2].blue + c[3].blue + 2) / 4;
+      }
+    }
+    return result;
+  }
+
+  earth_texture earth_texture::with_mipmaps(std::string const & path, std::string const & cache_directory) const
+  {
+    if (!buffer)
+      return *this;
+    auto levels = std::make_shared<std::vector<earth_texture>>();
+    std::string cache_path = cache_directory.empty() || !cacheable ? std::string { } : texture_cache_path(path, cache_directory);
+    earth_texture const * previous = this;
+    while (previous->width > 1 || previous->height > 1) {
+      earth_texture next;
+      std::string level_cache_path = cache_path + ".mip" + std::to_string(levels->size() + 1);
+      if (cache_path.empty() || !next.load_cache(path, level_cache_path)) {
+	next = previous->downsampled();
+	if (!cache_path.empty())
+	  next.save_cache(path, level_cache_path);
+      }
+      levels->push_back(std::move(next));
+      previous = &levels->back();
+    }
+    earth_texture result { *this };
+    result.mipmaps = std::move(levels);
+    return result;
+  }
+
+  std::size_t earth_texture::level_count() const
+  {
+    return mipmaps ? mipmaps->size() + 1 : 1;
+  }
+
+  earth_texture const & earth_texture::level(std::size_t i) const
+  {
+    return i == 0 ? *this : (*mipmaps)[i - 1];
+  }
+
+  earth_texture const & earth_texture::level_for_footprint(double footprint) const
+  {
+    if (!mipmaps || !(footprint >= 2))
+      return *this;
+    std::size_t i = static_cast<std::size_t>(std::log2(footprint));
+    return level(std::min(i, level_count() - 1));
+  }
+
+  std::size_t earth_texture::texel_index(double x, double y) const
+  {
+    return texel_index_at_grid(grid_x(x), grid_y(y));
+  }
+
+  std::size_t earth_texture::texel_index_at_grid(std::size_t x, std::size_t y) const
+  {
+    if (layout == texture_layout::row_major)
+      return y * width + x;
+    std::size_t tile = (y / tile_size) * tiles_per_row + x / tile_size;
+    return tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size;
+  }
+
   color earth_texture::color_at_grid(std::size_t x, std::size_t y) const
   {
-    y = height - y - 1;
-    std::size_t offset = y * 3 * width + x * 3;
+    return color_at_texel(texel_index_at_grid(x, y));
+  }
+
+  color earth_texture::color_at_texel(std::size_t i) const
+  {
+    std::size_t offset = layout == texture_layout::row_major ? i * 3 : i * 4;
     return color {
       buffer[offset],
       buffer[offset + 1],
@@ -30,13 +552,12 @@ namespace mkworldmap
 
   color earth_texture::color_at(double x, double y) const
   {
-    x = clamp(x, longitude_min, longitude_max);
-    y = clamp(y, latitude_min, latitude_max);
-    double nx = (x - longitude_min) * (width - 1) / (longitude_max - longitude_min);
-    double ny = (y - latitude_min) * (height - 1) / (latitude_max - latitude_min);
-    std::size_t ix = static_cast<std::size_t>(nx);
-    std::size_t iy = static_cast<std::size_t>(ny);
-    return color_at_grid(ix, iy);
+    return color_at_grid(grid_x(x), grid_y(y));
+  }
+
+  color earth_texture::color_at(double x, double y, double footprint) const
+  {
+    return level_for_footprint(footprint).color_at(x, y);
   }
   
   earth_texture::operator bool() const
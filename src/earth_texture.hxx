@@ -4,23 +4,49 @@
 #include <string>
 #include <memory>
 #include <numbers>
+#include <vector>
 
 #include "util.hxx"
 
 namespace mkworldmap
 {
+  enum class texture_layout
+  {
+    row_major,
+    tiled
+  };
+
+  // The part of the globe a render samples, in radians, and the angle
+  // one output pixel spans where the map is most detailed.  A resolution
+  // of 0 asks for the texture at its full size.
+  struct texture_region
+  {
+    double longitude_min = -std::numbers::pi;
+    double longitude_max = std::numbers::pi;
+    double latitude_min = -std::numbers::pi * 0.5;
+    double latitude_max = std::numbers::pi * 0.5;
+    double resolution = 0;
+  };
+
   class earth_texture
   {
     int width;
     int height;
+    texture_layout layout = texture_layout::row_major;
+    std::size_t tiles_per_row = 0;
     std::shared_ptr<char unsigned[]> buffer;
+    std::shared_ptr<std::vector<earth_texture> const> mipmaps;
+    double longitude_min = -std::numbers::pi;
+    double longitude_max = std::numbers::pi;
+    double latitude_min = -std::numbers::pi * 0.5;
+    double latitude_max = std::numbers::pi * 0.5;
+    bool cacheable = true;
 
-    color color_at_grid(std::size_t, std::size_t) const;
+    bool load_cache(std::string const &, std::string const &);
+    bool save_cache(std::string const &, std::string const &) const;
+    bool load_jpeg(std::string const &, texture_region const &);
 
-    static double constexpr longitude_min = -std::numbers::pi;
-    static double constexpr longitude_max = std::numbers::pi;
-    static double constexpr latitude_min = -std::numbers::pi * 0.5;
-    static double constexpr latitude_max = std::numbers::pi * 0.5;
+    static std::size_t constexpr tile_size = 32;
 
   public:
 
@@ -30,8 +56,29 @@ namespace mkworldmap
     earth_texture & operator=(earth_texture const &) = default;
     earth_texture & operator=(earth_texture &&) = default;
     earth_texture(std::string const &);
+    earth_texture(std::string const &, std::string const &);
+    earth_texture(std::string const &, texture_region const &);
 
+    earth_texture tiled() const;
+    earth_texture downsampled() const;
+    earth_texture with_mipmaps(std::string const & = { }, std::string const & = { }) const;
+
+    int grid_width() const;
+    int grid_height() const;
+    texture_layout grid_layout() const;
+    double longitude_span() const;
+    double latitude_span() const;
+    std::size_t level_count() const;
+    earth_texture const & level(std::size_t) const;
+    earth_texture const & level_for_footprint(double) const;
+    std::size_t grid_x(double) const;
+    std::size_t grid_y(double) const;
+    std::size_t texel_index(double, double) const;
+    std::size_t texel_index_at_grid(std::size_t, std::size_t) const;
+    color color_at_grid(std::size_t, std::size_t) const;
+    color color_at_texel(std::size_t) const;
     color color_at(double, double) const;
+    color color_at(double, double, double) const;
     
     explicit operator bool() const;
   };
@@ -0,0 +1,84 @@
+#ifndef MKWORLDMAP_FAST_MATH_HXX_2026_10_17_D6QW9TZL3MXE
+#define MKWORLDMAP_FAST_MATH_HXX_2026_10_17_D6QW9TZL3MXE
+
+#include <cmath>
+#include <numbers>
+
+namespace mkworldmap::fast_math
+{
+  // Single-precision approximations for the per-pixel inverse math.  The
+  // polynomials are from Abramowitz and Stegun and are accurate to about
+  // 2e-8 in exact arithmetic, so the error is dominated by float rounding
+  // (about 1e-7 relative).  None of them handle NaN or infinity specially.
+
+  float constexpr pi = std::numbers::pi_v<float>;
+  float constexpr half_pi = std::numbers::pi_v<float> * 0.5f;
+
+  // A&S 4.4.49, for 0 <= x <= 1.
+  inline float atan_unit(float x)
+  {
+    float x2 = x * x;
+    return x * (0.9999993329f
+		+ x2 * (-0.3332985605f
+			+ x2 * (0.1994653599f
+				+ x2 * (-0.1390853351f
+					+ x2 * (0.0964200441f
+						+ x2 * (-0.0559098861f
+							+ x2 * (0.0218612288f
+								+ x2 * -0.0040540580f)))))));
+  }
+
+  inline float atan2(float y, float x)
+  {
+    float ax = std::abs(x);
+    float ay = std::abs(y);
+    float a = ax >= ay
+      ? (ax == 0 ? 0 : atan_unit(ay / ax))
+      : half_pi - atan_unit(ax / ay);
+    if (x < 0)
+      a = pi - a;
+    return y < 0 ? -a : a;
+  }
+
+  // A&S 4.4.46, extended to -1 <= x <= 1 by symmetry.
+  inline float asin(float x)
+  {
+    float ax = std::abs(x);
+    float p = 1.5707963050f
+      + ax * (-0.2145988016f
+	      + ax * (0.0889789874f
+		      + ax * (-0.0501743046f
+			      + ax * (0.0308918810f
+				      + ax * (-0.0170881256f
+					      + ax * (0.0066700901f
+						      + ax * -0.0012624911f))))));
+    float a = half_pi - std::sqrt(1 - ax) * p;
+    return x < 0 ? -a : a;
+  }
+
+  // Taylor series to x^11, for -pi/2 <= x <= pi/2.
+  inline float sin_half_range(float x)
+  {
+    float x2 = x * x;
+    return x * (1
+		+ x2 * (-1.0f / 6
+			+ x2 * (1.0f / 120
+				+ x2 * (-1.0f / 5040
+					+ x2 * (1.0f / 362880
+						+ x2 * -1.0f / 39916800)))));
+  }
+
+  // For 0 <= x <= pi.
+  inline float sin(float x)
+  {
+    return sin_half_range(x > half_pi ? pi - x : x);
+  }
+
+  // For 0 <= x <= pi.
+  inline float cos(float x)
+  {
+    return sin_half_range(half_pi - x);
+  }
+}
+
+#endif
@@ -1,56 +1,1058 @@
 #include <iostream>
+#include <cstdio>
 #include <cmath>
 #include <memory>
 #include <numbers>
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include <stb_image_write.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <numeric>
+#include <vector>
 
 #include "image_creator.hxx"
+#include "image_writer.hxx"
+#include "parallel.hxx"
 
 namespace mkworldmap
 {
-  image_creator::image_creator(earth_texture const & texture, projection const & proj, std::size_t width, double sl, bool south_up)
+  image_creator::image_creator(earth_texture const & texture, projection const & proj, std::size_t width, double sl, bool south_up, std::size_t threads)
+    : image_creator {
+	texture,
+	proj,
+	proj.bounds(),
+	width,
+	static_cast<std::size_t>(width * proj.height() / proj.width()),
+	sl,
+	south_up,
+	threads
+      }
+  {
+  }
+
+  image_creator::image_creator(earth_texture const & texture, projection const & proj, viewport view, std::size_t width, std::size_t height, double sl, bool south_up, std::size_t threads)
     : width { width },
-      height { static_cast<std::size_t>(width * proj.height() / proj.width()) },
+      height { height },
       standard_longitude { sl },
       texture { texture },
       south_up { south_up },
-      proj { proj }
+      proj { proj },
+      view { view },
+      threads { threads }
+  {
+  }
+
+  void image_creator::set_antialiasing(std::size_t samples)
+  {
+    antialiasing = std::clamp<std::size_t>(samples, 1, max_antialiasing);
+  }
+
+  void image_creator::set_approximation(double tolerance)
+  {
+    approximation = std::max(tolerance, 0.0);
+  }
+
+  void image_creator::set_profiler(profiler * p)
+  {
+    prof = p;
+  }
+
+  void image_creator::set_output_options(image_options const & options)
   {
+    output = options;
   }
 
-  color image_creator::color_at(double x, double y) const
+  void image_creator::set_output_stream(std::FILE * stream)
   {
-    if (south_up) {
+    output_stream = stream;
+  }
+
+  std::size_t image_creator::image_width() const
+  {
+    return width;
+  }
+
+  std::size_t image_creator::image_height() const
+  {
+    return height;
+  }
+
+  double image_creator::projected_x(double x) const
+  {
+    if (south_up)
       x = width - x - 1;
+    return x * view.width() / (width - 1) + view.x_min;
+  }
+
+  double image_creator::projected_y(double y) const
+  {
+    if (south_up)
       y = height - y - 1;
-    }
-    double nx =  x * proj.width() / (width - 1) + proj.x_min;
-    double ny = y * proj.height() / (height - 1) + proj.y_min;
-    point p = proj.invert(nx, ny);
+    return y * view.height() / (height - 1) + view.y_min;
+  }
+
+  double image_creator::texture_longitude(double x) const
+  {
+    return texture_longitude(x, standard_longitude);
+  }
+
+  double image_creator::texture_longitude(double x, double sl) const
+  {
+    x += sl;
+    if (x < std::numbers::pi)
+      x += 2 * std::numbers::pi;
+    if (x >= std::numbers::pi)
+      x -= 2 * std::numbers::pi;
+    return x;
+  }
+
+  color image_creator::color_at(point p) const
+  {
     if (std::isnan(p.x) || std::isnan(p.y))
-      return color { 0xaa, 0xaa, 0xaa };
-    p.x += standard_longitude;
-    if (p.x < std::numbers::pi)
-      p.x += 2 * std::numbers::pi;
-    if (p.x >= std::numbers::pi)
-      p.x -= 2 * std::numbers::pi;
-    return texture.color_at(p.x, p.y);
+      return background;
+    return texture.color_at(texture_longitude(p.x), p.y);
+  }
+
+  color image_creator::color_at(point p, double footprint) const
+  {
+    if (std::isnan(p.x) || std::isnan(p.y))
+      return background;
+    return texture.color_at(texture_longitude(p.x), p.y, footprint);
+  }
+
+  // The range of xs that can land on the map in row y.  The projection's
+  // domain is widened a little so that pixels on its edge are still
+  // decided by invert.
+  std::pair<std::size_t, std::size_t> image_creator::domain_range(std::span<double const> xs, double y) const
+  {
+    auto [x_lo, x_hi] = proj.x_domain(y);
+    double margin = 1e-9 * proj.width();
+    x_lo -= margin;
+    x_hi += margin;
+    std::size_t begin = 0;
+    std::size_t end = xs.size();
+    while (begin < end && !(xs[begin] >= x_lo && xs[begin] <= x_hi))
+      ++begin;
+    while (end > begin && !(xs[end - 1] >= x_lo && xs[end - 1] <= x_hi))
+      --end;
+    return { begin, end };
+  }
+
+  void image_creator::invert_span(std::span<double const> xs, double y, std::span<point> out) const
+  {
+    auto [begin, end] = domain_range(xs, y);
+    point constexpr outside { std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN() };
+    std::fill(out.begin(), out.begin() + begin, outside);
+    std::fill(out.begin() + end, out.begin() + xs.size(), outside);
+    proj.invert_many(xs.subspan(begin, end - begin), y, out.subspan(begin, end - begin));
+  }
+
+  void image_creator::fill_background(char unsigned * row, std::size_t count) const
+  {
+    for (std::size_t x = 0; x < count; ++x) {
+      *row++ = background.red;
+      *row++ = background.green;
+      *row++ = background.blue;
+    }
+  }
+
+  // points is scratch space as long as xs.
+  void image_creator::render_row(char unsigned * row, std::size_t y, std::span<double const> xs, std::span<point> points) const
+  {
+    double py = projected_y(y);
+    auto [begin, end] = domain_range(xs, py);
+    fill_background(row, begin);
+    fill_background(row + end * 3, xs.size() - end);
+    points = points.subspan(begin, end - begin);
+    proj.invert_many(xs.subspan(begin, end - begin), py, points);
+    row += begin * 3;
+    for (point p : points) {
+      color c = color_at(p);
+      *row++ = c.red;
+      *row++ = c.green;
+      *row++ = c.blue;
+    }
+  }
+
+  std::vector<std::size_t> image_creator::texture_columns(std::span<double const> xs) const
+  {
+    std::vector<point> points(width);
+    proj.invert_many(xs, projected_y(0), points);
+    std::vector<std::size_t> columns(width);
+    for (std::size_t x = 0; x < width; ++x)
+      columns[x] = std::isnan(points[x].x) ? no_texel : texture.grid_x(texture_longitude(points[x].x));
+    return columns;
+  }
+
+  std::size_t image_creator::texture_row(std::size_t y) const
+  {
+    point p = proj.invert(projected_x(0), projected_y(y));
+    return std::isnan(p.y) ? no_texel : texture.grid_y(p.y);
+  }
+
+  void image_creator::render_separable_row(char unsigned * row, std::size_t y, std::span<std::size_t const> columns) const
+  {
+    std::size_t texture_y = texture_row(y);
+    for (std::size_t texture_x : columns) {
+      color c = texture_x == no_texel || texture_y == no_texel ? background : texture.color_at_grid(texture_x, texture_y);
+      *row++ = c.red;
+      *row++ = c.green;
+      *row++ = c.blue;
+    }
+  }
+
+  // points is scratch space as long as xs.
+  void image_creator::remap_row(std::span<std::uint32_t> indices, std::size_t y, std::span<double const> xs, std::span<point> points) const
+  {
+    invert_span(xs, projected_y(y), points);
+    for (std::size_t x = 0; x < xs.size(); ++x) {
+      point p = points[x];
+      if (std::isnan(p.x) || std::isnan(p.y))
+	indices[x] = remap_table::background;
+      else
+	indices[x] = texture.texel_index(texture_longitude(p.x), p.y);
+    }
+  }
+
+  void image_creator::remap_separable_row(std::span<std::uint32_t> indices, std::size_t y, std::span<std::size_t const> columns) const
+  {
+    std::size_t texture_y = texture_row(y);
+    for (std::size_t x = 0; x < width; ++x) {
+      if (columns[x] == no_texel || texture_y == no_texel)
+	indices[x] = remap_table::background;
+      else
+	indices[x] = texture.texel_index_at_grid(columns[x], texture_y);
+    }
   }
 
-  void image_creator::save_image(std::string const & path) const
+  void image_creator::render_remapped_row(char unsigned * row, std::span<std::uint32_t const> indices) const
+  {
+    for (std::uint32_t i : indices) {
+      color c = i == remap_table::background ? background : texture.color_at_texel(i);
+      *row++ = c.red;
+      *row++ = c.green;
+      *row++ = c.blue;
+    }
+  }
+
+  std::size_t image_creator::tile_count(std::size_t rows) const
+  {
+    return ((width + tile_size - 1) / tile_size) * ((rows + tile_size - 1) / tile_size);
+  }
+
+  image_creator::tile_range image_creator::tile_at(std::size_t tile, std::size_t i_begin, std::size_t i_end) const
+  {
+    std::size_t tiles_per_row = (width + tile_size - 1) / tile_size;
+    std::size_t x_begin = tile % tiles_per_row * tile_size;
+    std::size_t tile_begin = i_begin + tile / tiles_per_row * tile_size;
+    return tile_range {
+      x_begin,
+      std::min(x_begin + tile_size, width),
+      tile_begin,
+      std::min(tile_begin + tile_size, i_end)
+    };
+  }
+
+  void image_creator::for_each_tile_row(std::size_t tile, std::size_t i_begin, std::size_t i_end, std::function<void(std::size_t, std::size_t, std::size_t)> const & f) const
+  {
+    tile_range range = tile_at(tile, i_begin, i_end);
+    for (std::size_t i = range.i_begin; i < range.i_end; ++i)
+      f(i, range.x_begin, range.x_end - range.x_begin);
+  }
+
+  double image_creator::texel_distance(point p, point q) const
+  {
+    double dx = std::abs(p.x - q.x);
+    if (dx > std::numbers::pi)
+      dx = 2 * std::numbers::pi - dx;
+    double dy = std::abs(p.y - q.y);
+    return std::max(dx * (texture.grid_width() - 1) / texture.longitude_span(),
+		    dy * (texture.grid_height() - 1) / texture.latitude_span());
+  }
+
+  double image_creator::footprint(point p, point right, point down) const
+  {
+    double footprint = 0;
+    if (!std::isnan(right.x))
+      footprint = std::max(footprint, texel_distance(p, right));
+    if (!std::isnan(down.x))
+      footprint = std::max(footprint, texel_distance(p, down));
+    return footprint;
+  }
+
+  bool image_creator::needs_refinement(point p, point right, point down) const
+  {
+    if (antialiasing <= 1)
+      return false;
+    bool outside = std::isnan(p.x);
+    if (outside != std::isnan(right.x) || outside != std::isnan(down.x))
+      return true;
+    if (outside)
+      return false;
+    double max_footprint = std::max(1.0, 2.0 * texture.grid_width() / width);
+    return texel_distance(p, right) > max_footprint || texel_distance(p, down) > max_footprint;
+  }
+
+  color image_creator::supersample(double x, double y, double footprint) const
+  {
+    std::size_t red = 0;
+    std::size_t green = 0;
+    std::size_t blue = 0;
+    for (std::size_t sy = 0; sy < antialiasing; ++sy) {
+      for (std::size_t sx = 0; sx < antialiasing; ++sx) {
+	double ox = (sx + 0.5) / antialiasing - 0.5;
+	double oy = (sy + 0.5) / antialiasing - 0.5;
+	double px = projected_x(x + ox);
+	double py = projected_y(y + oy);
+	color c = domain_range(std::span<double const> { &px, 1 }, py).second == 0
+	  ? background
+	  : color_at(proj.invert(px, py), footprint / antialiasing);
+	red += c.red;
+	green += c.green;
+	blue += c.blue;
+      }
+    }
+    std::size_t count = antialiasing * antialiasing;
+    return color {
+      static_cast<char unsigned>((red + count / 2) / count),
+      static_cast<char unsigned>((green + count / 2) / count),
+      static_cast<char unsigned>((blue + count / 2) / count)
+    };
+  }
+
+  void image_creator::render_filtered_tile(char unsigned * strip, std::size_t i_begin, tile_range range, std::span<double const> xs) const
+  {
+    std::size_t columns = range.x_end - range.x_begin;
+    std::size_t rows = range.i_end - range.i_begin;
+    // The grid line past the last pixel repeats the one before it, or the
+    // only one of an image a single pixel wide or high.
+    std::size_t last_x = width > 1 ? width - 2 : 0;
+    std::size_t last_i = height > 1 ? height - 2 : 0;
+    std::vector<double> grid_xs(columns + 1);
+    for (std::size_t c = 0; c <= columns; ++c) {
+      std::size_t x = range.x_begin + c;
+      grid_xs[c] = xs[x < width ? x : last_x];
+    }
+    std::vector<point> grid((rows + 1) * (columns + 1));
+    for (std::size_t r = 0; r <= rows; ++r) {
+      std::size_t i = range.i_begin + r;
+      std::size_t y = height - (i < height ? i : last_i) - 1;
+      invert_span(grid_xs, projected_y(y), std::span<point> { grid }.subspan(r * (columns + 1), columns + 1));
+    }
+
+    if (prof) {
+      std::size_t outside = 0;
+      for (std::size_t r = 0; r < rows; ++r)
+	for (std::size_t c = 0; c < columns; ++c)
+	  outside += std::isnan(grid[r * (columns + 1) + c].x);
+      prof->add_pixels(rows * columns, outside);
+    }
+
+    for (std::size_t r = 0; r < rows; ++r) {
+      std::size_t i = range.i_begin + r;
+      char unsigned * row = strip + ((i - i_begin) * width + range.x_begin) * 3;
+      for (std::size_t c = 0; c < columns; ++c) {
+	point p = grid[r * (columns + 1) + c];
+	point right = grid[r * (columns + 1) + c + 1];
+	point down = grid[(r + 1) * (columns + 1) + c];
+	double f = std::isnan(p.x) ? 0 : footprint(p, right, down);
+	color k = needs_refinement(p, right, down)
+	  ? supersample(range.x_begin + c, height - i - 1, f)
+	  : color_at(p, f);
+	*row++ = k.red;
+	*row++ = k.green;
+	*row++ = k.blue;
+      }
+    }
+  }
+
+  // Fills the tile's points, row by row, starting from one cell spanning
+  // the tile whose corners are pixel centres.  A cell is interpolated
+  // bilinearly when every row of it lies inside the projection's domain,
+  // its corners are on the map less than half a turn of longitude apart,
+  // and at its centre and edge midpoints the interpolated point is within
+  // half the tolerance of the inverted one; otherwise it is split in two
+  // along each side longer than a pixel.  Cells wholly outside the domain
+  // are left off the map, and cells too small to split only hold corners,
+  // which are inverted.  Neighbouring cells share their edges, and a pixel
+  // once inverted is never overwritten.  Returns how many times invert was
+  // called.
+  std::size_t image_creator::approximate_tile(tile_range range, std::span<double const> xs, std::span<point> grid) const
+  {
+    struct cell
+    {
+      std::size_t r0;
+      std::size_t c0;
+      std::size_t r1;
+      std::size_t c1;
+    };
+
+    std::size_t columns = range.x_end - range.x_begin;
+    std::size_t rows = range.i_end - range.i_begin;
+    std::span<double const> tile_xs = xs.subspan(range.x_begin, columns);
+    std::vector<double> ys(rows);
+    std::vector<std::pair<std::size_t, std::size_t>> domains(rows);
+    for (std::size_t r = 0; r < rows; ++r) {
+      ys[r] = projected_y(height - (range.i_begin + r) - 1);
+      domains[r] = domain_range(tile_xs, ys[r]);
+    }
+
+    point constexpr outside { std::numeric_limits<double>::quiet_NaN(), std::numeric_limits<double>::quiet_NaN() };
+    std::vector<char> inverted(rows * columns);
+    std::size_t inversions = 0;
+    auto exact = [&](std::size_t r, std::size_t c) {
+      std::size_t k = r * columns + c;
+      if (!inverted[k]) {
+	auto [begin, end] = domains[r];
+	bool in_domain = c >= begin && c < end;
+	grid[k] = in_domain ? proj.invert(tile_xs[c], ys[r]) : outside;
+	inverted[k] = true;
+	inversions += in_domain;
+      }
+      return grid[k];
+    };
+    auto on_map = [](point p) {
+      return !std::isnan(p.x) && !std::isnan(p.y);
+    };
+
+    std::vector<cell> cells { cell { 0, 0, rows - 1, columns - 1 } };
+    while (!cells.empty()) {
+      cell k = cells.back();
+      cells.pop_back();
+      bool inside = true;
+      bool beyond = true;
+      for (std::size_t r = k.r0; r <= k.r1; ++r) {
+	auto [begin, end] = domains[r];
+	inside = inside && begin <= k.c0 && end > k.c1;
+	beyond = beyond && (end <= k.c0 || begin > k.c1);
+      }
+      if (beyond) {
+	for (std::size_t r = k.r0; r <= k.r1; ++r)
+	  for (std::size_t c = k.c0; c <= k.c1; ++c)
+	    grid[r * columns + c] = outside;
+	continue;
+      }
+      point corners[4] = { exact(k.r0, k.c0), exact(k.r0, k.c1), exact(k.r1, k.c0), exact(k.r1, k.c1) };
+      if (k.r1 - k.r0 <= 1 && k.c1 - k.c0 <= 1)
+	continue;
+
+      std::size_t rm = (k.r0 + k.r1) / 2;
+      std::size_t cm = (k.c0 + k.c1) / 2;
+      double u_scale = k.c1 > k.c0 ? 1.0 / (k.c1 - k.c0) : 0.0;
+      double v_scale = k.r1 > k.r0 ? 1.0 / (k.r1 - k.r0) : 0.0;
+      auto interpolate = [&](std::size_t r, std::size_t c) {
+	double u = (c - k.c0) * u_scale;
+	double v = (r - k.r0) * v_scale;
+	return point {
+	  (1 - v) * ((1 - u) * corners[0].x + u * corners[1].x) + v * ((1 - u) * corners[2].x + u * corners[3].x),
+	  (1 - v) * ((1 - u) * corners[0].y + u * corners[1].y) + v * ((1 - u) * corners[2].y + u * corners[3].y)
+	};
+      };
+      bool smooth = inside && std::all_of(std::begin(corners), std::end(corners), on_map);
+      if (smooth) {
+	auto [west, east] = std::minmax({ corners[0].x, corners[1].x, corners[2].x, corners[3].x });
+	auto close = [&](std::size_t r, std::size_t c) {
+	  point p = exact(r, c);
+	  return on_map(p) && texel_distance(interpolate(r, c), p) <= approximation / 2;
+	};
+	smooth = east - west < std::numbers::pi && close(rm, cm) && close(k.r0, cm) && close(k.r1, cm) && close(rm, k.c0) && close(rm, k.c1);
+      }
+      if (smooth) {
+	for (std::size_t r = k.r0; r <= k.r1; ++r)
+	  for (std::size_t c = k.c0; c <= k.c1; ++c)
+	    if (!inverted[r * columns + c])
+	      grid[r * columns + c] = interpolate(r, c);
+	continue;
+      }
+
+      bool split_rows = k.r1 - k.r0 >= 2;
+      bool split_columns = k.c1 - k.c0 >= 2;
+      for (std::size_t a = 0; a <= split_rows; ++a)
+	for (std::size_t b = 0; b <= split_columns; ++b)
+	  cells.push_back(cell {
+	      split_rows ? (a ? rm : k.r0) : k.r0,
+	      split_columns ? (b ? cm : k.c0) : k.c0,
+	      split_rows ? (a ? k.r1 : rm) : k.r1,
+	      split_columns ? (b ? k.c1 : cm) : k.c1
+	    });
+    }
+    return inversions;
+  }
+
+  // Writes the rows of the tile that fall in [i_begin, i_end).  Tiles
+  // are aligned to the whole image rather than to the strip, so that the
+  // approximation does not depend on how the image is split.
+  void image_creator::render_approximate_tile(char unsigned * strip, std::size_t i_begin, std::size_t i_end, tile_range range, std::span<double const> xs) const
+  {
+    std::size_t columns = range.x_end - range.x_begin;
+    std::array<point, tile_size * tile_size> grid_buffer;
+    std::span<point> grid { grid_buffer.data(), (range.i_end - range.i_begin) * columns };
+    approximate_tile(range, xs, grid);
+    std::size_t first = std::max(range.i_begin, i_begin);
+    std::size_t last = std::min(range.i_end, i_end);
+    std::span<point const> rows = grid.subspan((first - range.i_begin) * columns, (last - first) * columns);
+    if (prof)
+      prof->add_pixels(rows.size(), std::count_if(rows.begin(), rows.end(), [](point p) {
+	return std::isnan(p.x) || std::isnan(p.y);
+      }));
+    for (std::size_t i = first; i < last; ++i) {
+      char unsigned * row = strip + ((i - i_begin) * width + range.x_begin) * 3;
+      for (point p : rows.subspan((i - first) * columns, columns)) {
+	color c = color_at(p);
+	*row++ = c.red;
+	*row++ = c.green;
+	*row++ = c.blue;
+      }
+    }
+  }
+
+  void image_creator::remap_approximate_tile(remap_table & table, tile_range range, std::span<double const> xs) const
+  {
+    std::size_t columns = range.x_end - range.x_begin;
+    std::array<point, tile_size * tile_size> grid_buffer;
+    std::span<point> grid { grid_buffer.data(), (range.i_end - range.i_begin) * columns };
+    approximate_tile(range, xs, grid);
+    for (std::size_t i = range.i_begin; i < range.i_end; ++i) {
+      std::span<std::uint32_t> indices = table.row(i).subspan(range.x_begin, columns);
+      std::span<point const> points = grid.subspan((i - range.i_begin) * columns, columns);
+      for (std::size_t x = 0; x < columns; ++x) {
+	point p = points[x];
+	if (std::isnan(p.x) || std::isnan(p.y))
+	  indices[x] = remap_table::background;
+	else
+	  indices[x] = texture.texel_index(texture_longitude(p.x), p.y);
+      }
+    }
+  }
+
+  std::vector<double> image_creator::projected_xs() const
+  {
+    std::vector<double> xs(width);
+    for (std::size_t x = 0; x < width; ++x)
+      xs[x] = projected_x(x);
+    return xs;
+  }
+
+  // Calls f with the row and column of every pixel past the projection's
+  // bounds, which a viewport wider than the map leaves; those pixels are
+  // background whatever they invert to.
+  void image_creator::for_each_clipped(std::size_t i_begin, std::size_t i_end, std::span<double const> xs, std::function<void(std::size_t, std::size_t)> const & f) const
+  {
+    viewport bounds = proj.bounds();
+    if (view.x_min >= bounds.x_min && view.x_max <= bounds.x_max && view.y_min >= bounds.y_min && view.y_max <= bounds.y_max)
+      return;
+    double epsilon = 1e-9 * std::max(bounds.width(), bounds.height());
+    for (std::size_t i = i_begin; i < i_end; ++i) {
+      double y = projected_y(height - i - 1);
+      bool outside = y < bounds.y_min - epsilon || y > bounds.y_max + epsilon;
+      for (std::size_t x = 0; x < width; ++x)
+	if (outside || xs[x] < bounds.x_min - epsilon || xs[x] > bounds.x_max + epsilon)
+	  f(i, x);
+    }
+  }
+
+  void image_creator::clip_rows(char unsigned * strip, std::size_t i_begin, std::size_t i_end, std::span<double const> xs) const
+  {
+    for_each_clipped(i_begin, i_end, xs, [&](std::size_t i, std::size_t x) {
+      char unsigned * pixel = strip + ((i - i_begin) * width + x) * 3;
+      pixel[0] = background.red;
+      pixel[1] = background.green;
+      pixel[2] = background.blue;
+    });
+  }
+
+  void image_creator::run_tasks(std::size_t count, std::function<void(std::size_t)> const & task) const
+  {
+    if (!prof) {
+      parallel_for(count, threads, task);
+      return;
+    }
+    std::size_t workers = std::max<std::size_t>(threads, 1);
+    std::vector<std::size_t> tasks(workers);
+    std::vector<std::chrono::steady_clock::duration> busy(workers);
+    parallel_for(count, threads, [&](std::size_t index, std::size_t worker) {
+      auto start = std::chrono::steady_clock::now();
+      task(index);
+      busy[worker] += std::chrono::steady_clock::now() - start;
+      ++tasks[worker];
+    });
+    for (std::size_t w = 0; w < workers; ++w)
+      if (tasks[w])
+	prof->add_worker(w, tasks[w], std::chrono::duration<double> { busy[w] }.count());
+  }
+
+  void image_creator::render_rows(char unsigned * strip, std::size_t i_begin, std::size_t i_end, std::span<double const> xs, std::span<std::size_t const> columns) const
+  {
+    if (antialiasing > 1 || texture.level_count() > 1) {
+      profiler::scope phase { prof, "render" };
+      run_tasks(tile_count(i_end - i_begin), [&](std::size_t tile) {
+	render_filtered_tile(strip, i_begin, tile_at(tile, i_begin, i_end), xs);
+      });
+    } else if (approximation > 0 && !proj.separable()) {
+      profiler::scope phase { prof, "render" };
+      std::size_t aligned_begin = i_begin / tile_size * tile_size;
+      run_tasks(tile_count(i_end - aligned_begin), [&](std::size_t tile) {
+	render_approximate_tile(strip, i_begin, i_end, tile_at(tile, aligned_begin, height), xs);
+      });
+    } else if (prof) {
+      render_profiled_rows(strip, i_begin, i_end, xs);
+    } else if (proj.separable()) {
+      run_tasks(i_end - i_begin, [&](std::size_t i) {
+	render_separable_row(strip + i * width * 3, height - (i_begin + i) - 1, columns);
+      });
+    } else {
+      run_tasks(tile_count(i_end - i_begin), [&](std::size_t tile) {
+	std::array<point, tile_size> points;
+	for_each_tile_row(tile, i_begin, i_end, [&](std::size_t i, std::size_t x, std::size_t n) {
+	  render_row(strip + ((i - i_begin) * width + x) * 3, height - i - 1, xs.subspan(x, n), std::span<point> { points }.first(n));
+	});
+      });
+    }
+    clip_rows(strip, i_begin, i_end, xs);
+  }
+
+  // Splits the work into an inverse pass and a gather pass over blocks of
+  // rows so that the two can be timed apart.  The pixels are the same as
+  // the ones render_rows produces without a profiler.
+  void image_creator::render_profiled_rows(char unsigned * strip, std::size_t i_begin, std::size_t i_end, std::span<double const> xs) const
+  {
+    for (std::size_t block = i_begin; block < i_end; block += profile_block_rows) {
+      std::size_t block_end = std::min(block + profile_block_rows, i_end);
+      std::vector<point> grid;
+      {
+	profiler::scope phase { prof, "invert" };
+	grid = inverse_grid(xs, block, block_end);
+      }
+      prof->add_pixels(grid.size(), std::count_if(grid.begin(), grid.end(), [](point p) {
+	return std::isnan(p.x) || std::isnan(p.y);
+      }));
+      profiler::scope phase { prof, "gather" };
+      render_frame(strip + (block - i_begin) * width * 3, grid, standard_longitude);
+    }
+  }
+
+  void image_creator::render_remapped_rows(char unsigned * strip, std::size_t i_begin, std::size_t i_end, remap_table const & table) const
+  {
+    profiler::scope phase { prof, "gather" };
+    run_tasks(i_end - i_begin, [&](std::size_t i) {
+      render_remapped_row(strip + i * width * 3, table.row(i_begin + i));
+    });
+    if (prof) {
+      std::size_t outside = 0;
+      for (std::size_t i = i_begin; i < i_end; ++i)
+	outside += std::count(table.row(i).begin(), table.row(i).end(), remap_table::background);
+      prof->add_pixels((i_end - i_begin) * width, outside);
+    }
+  }
+
+  remap_table image_creator::make_remap_table() const
+  {
+    profiler::scope phase { prof, "remap table" };
+    remap_table table { width, height };
+    std::vector<double> xs = projected_xs();
+    if (proj.separable()) {
+      std::vector<std::size_t> columns = texture_columns(xs);
+      run_tasks(height, [&](std::size_t i) {
+	remap_separable_row(table.row(i), height - i - 1, columns);
+      });
+    } else if (approximation > 0) {
+      run_tasks(tile_count(height), [&](std::size_t tile) {
+	remap_approximate_tile(table, tile_at(tile, 0, height), xs);
+      });
+    } else {
+      run_tasks(tile_count(height), [&](std::size_t tile) {
+	std::array<point, tile_size> points;
+	for_each_tile_row(tile, 0, height, [&](std::size_t i, std::size_t x, std::size_t n) {
+	  remap_row(table.row(i).subspan(x, n), height - i - 1, std::span<double const> { xs }.subspan(x, n), std::span<point> { points }.first(n));
+	});
+      });
+    }
+    for_each_clipped(0, height, xs, [&](std::size_t i, std::size_t x) {
+      table.row(i)[x] = remap_table::background;
+    });
+    return table;
+  }
+
+  // The larger of the differences between the texel columns and rows two
+  // points fall on, or no_texel when only one of them is on the map.
+  std::size_t image_creator::texel_difference(point expected, point actual) const
+  {
+    bool expected_outside = std::isnan(expected.x) || std::isnan(expected.y);
+    bool actual_outside = std::isnan(actual.x) || std::isnan(actual.y);
+    if (expected_outside != actual_outside)
+      return no_texel;
+    if (expected_outside)
+      return 0;
+    std::size_t ex = texture.grid_x(texture_longitude(expected.x));
+    std::size_t ax = texture.grid_x(texture_longitude(actual.x));
+    std::size_t dx = ex > ax ? ex - ax : ax - ex;
+    dx = std::min(dx, static_cast<std::size_t>(texture.grid_width()) - 1 - dx);
+    std::size_t ey = texture.grid_y(expected.y);
+    std::size_t ay = texture.grid_y(actual.y);
+    std::size_t dy = ey > ay ? ey - ay : ay - ey;
+    return std::max(dx, dy);
+  }
+
+  // Compares the texels this creator's projection and another one pick for
+  // every row_stride-th row of the image.  Returns the largest difference
+  // in texels along either axis, or SIZE_MAX when one of them leaves a
+  // pixel as background and the other does not.
+  std::size_t image_creator::max_texel_difference(projection const & other, std::size_t row_stride) const
+  {
+    std::vector<double> xs = projected_xs();
+    std::size_t rows = (height + row_stride - 1) / std::max<std::size_t>(row_stride, 1);
+    std::vector<std::size_t> differences(rows);
+    run_tasks(rows, [&](std::size_t r) {
+      double y = projected_y(r * row_stride);
+      std::vector<point> expected(width);
+      std::vector<point> actual(width);
+      proj.invert_many(xs, y, expected);
+      other.invert_many(xs, y, actual);
+      std::size_t difference = 0;
+      for (std::size_t x = 0; x < width && difference != no_texel; ++x)
+	difference = std::max(difference, texel_difference(expected[x], actual[x]));
+      differences[r] = difference;
+    });
+    return differences.empty() ? 0 : *std::max_element(differences.begin(), differences.end());
+  }
+
+  // Runs the approximation over the whole image and compares it with the
+  // exact inverse of every pixel.  Separable projections are never
+  // approximated, so for them every pixel counts as inverted.
+  image_creator::approximation_error image_creator::measure_approximation() const
+  {
+    std::vector<double> xs = projected_xs();
+    std::size_t tiles = tile_count(height);
+    std::vector<std::size_t> inversions(tiles);
+    std::vector<std::size_t> differences(tiles);
+    run_tasks(tiles, [&](std::size_t tile) {
+      tile_range range = tile_at(tile, 0, height);
+      std::size_t columns = range.x_end - range.x_begin;
+      std::array<point, tile_size * tile_size> approximate;
+      std::array<point, tile_size> expected;
+      if (proj.separable() || approximation <= 0) {
+	inversions[tile] = (range.i_end - range.i_begin) * columns;
+	return;
+      }
+      inversions[tile] = approximate_tile(range, xs, approximate);
+      for (std::size_t i = range.i_begin; i < range.i_end && differences[tile] != no_texel; ++i) {
+	std::span<point> row { expected.data(), columns };
+	invert_span(std::span<double const> { xs }.subspan(range.x_begin, columns), projected_y(height - i - 1), row);
+	for (std::size_t x = 0; x < columns && differences[tile] != no_texel; ++x)
+	  differences[tile] = std::max(differences[tile], texel_difference(row[x], approximate[(i - range.i_begin) * columns + x]));
+      }
+    });
+    return approximation_error {
+      std::accumulate(inversions.begin(), inversions.end(), std::size_t { 0 }),
+      width * height,
+      differences.empty() ? 0 : *std::max_element(differences.begin(), differences.end())
+    };
+  }
+
+  inverse_statistics image_creator::measure_iterations() const
+  {
+    std::vector<double> xs = projected_xs();
+    std::vector<inverse_statistics> rows(height);
+    run_tasks(height, [&](std::size_t i) {
+      std::vector<point> out(width);
+      double y = projected_y(i);
+      auto [begin, end] = domain_range(xs, y);
+      rows[i] = proj.invert_statistics(std::span<double const> { xs }.subspan(begin, end - begin), y, std::span<point> { out }.subspan(begin, end - begin));
+    });
+    inverse_statistics total;
+    for (inverse_statistics const & row : rows) {
+      total.solves += row.solves;
+      total.iterations += row.iterations;
+      total.max_iterations = std::max(total.max_iterations, row.max_iterations);
+      total.failures += row.failures;
+    }
+    return total;
+  }
+
+  std::unique_ptr<image_writer> image_creator::open_writer(std::string const & path) const
+  {
+    image_options options = output;
+    options.threads = threads;
+    if (output_stream)
+      return make_image_writer(output_stream, width, height, options);
+    return make_image_writer(path, width, height, options);
+  }
+
+  bool image_creator::write_image(std::string const & path, char unsigned const * buffer) const
+  {
+    profiler::scope phase { prof, "encode" };
+    std::unique_ptr<image_writer> writer = open_writer(path);
+    return writer && writer->write_rows(buffer, height) && writer->finish();
+  }
+
+  bool image_creator::write_strips(std::string const & path, std::size_t strip_height, std::function<void(char unsigned *, std::size_t, std::size_t)> const & render_strip) const
+  {
+    std::unique_ptr<image_writer> writer = open_writer(path);
+    if (!writer)
+      return false;
+    strip_height = std::clamp<std::size_t>(strip_height, 1, std::max<std::size_t>(height, 1));
+    std::array<std::unique_ptr<char unsigned[]>, 2> strips {
+      std::make_unique<char unsigned[]>(width * strip_height * 3),
+      std::make_unique<char unsigned[]>(width * strip_height * 3)
+    };
+    bool written = true;
+    std::future<bool> pending;
+    for (std::size_t i = 0, k = 0; i < height; i += strip_height, ++k) {
+      std::size_t rows = std::min(strip_height, height - i);
+      char unsigned * strip = strips[k % 2].get();
+      render_strip(strip, i, i + rows);
+      if (pending.valid())
+	written = pending.get() && written;
+      pending = std::async(std::launch::async, [this, &writer, strip, rows] {
+	profiler::scope phase { prof, "encode" };
+	return writer->write_rows(strip, rows);
+      });
+    }
+    if (pending.valid())
+      written = pending.get() && written;
+    return writer->finish() && written;
+  }
+
+  void image_creator::render(char unsigned * buffer) const
+  {
+    std::vector<double> xs = projected_xs();
+    std::vector<std::size_t> columns = proj.separable() ? texture_columns(xs) : std::vector<std::size_t> { };
+    render_rows(buffer, 0, height, xs, columns);
+  }
+
+  bool image_creator::save_image(std::string const & path) const
+  {
+    std::unique_ptr<char unsigned[]> buffer = std::make_unique<char unsigned[]>(width * height * 3);
+    render(buffer.get());
+    return write_image(path, buffer.get());
+  }
+
+  bool image_creator::save_image(std::string const & path, remap_table const & table) const
   {
     std::unique_ptr<char unsigned[]> buffer = std::make_unique<char unsigned[]>(width * height * 3);
-    std::size_t i = 0;
-    for (std::size_t y = height; y > 0; --y) {
-      for (std::size_t x = 0; x < width; ++x) {
-	color c = color_at(x, y - 1);
-	std::size_t offset = y * 3 * width + x * 3;
-	buffer[i++] = c.red;
-	buffer[i++] = c.green;
-	buffer[i++] = c.blue;
+    render_remapped_rows(buffer.get(), 0, height, table);
+    return write_image(path, buffer.get());
+  }
+
+  bool image_creator::stream_image(std::string const & path, std::size_t strip_height) const
+  {
+    std::vector<double> xs = projected_xs();
+    std::vector<std::size_t> columns = proj.separable() ? texture_columns(xs) : std::vector<std::size_t> { };
+    return write_strips(path, strip_height, [&](char unsigned * strip, std::size_t i_begin, std::size_t i_end) {
+      render_rows(strip, i_begin, i_end, xs, columns);
+    });
+  }
+
+  bool image_creator::stream_image(std::string const & path, remap_table const & table, std::size_t strip_height) const
+  {
+    return write_strips(path, strip_height, [&](char unsigned * strip, std::size_t i_begin, std::size_t i_end) {
+      render_remapped_rows(strip, i_begin, i_end, table);
+    });
+  }
+
+  std::vector<point> image_creator::inverse_grid(std::span<double const> xs, std::size_t i_begin, std::size_t i_end) const
+  {
+    std::vector<point> grid(width * (i_end - i_begin));
+    run_tasks(i_end - i_begin, [&](std::size_t i) {
+      invert_span(xs, projected_y(height - (i_begin + i) - 1), std::span<point> { grid }.subspan(i * width, width));
+    });
+    return grid;
+  }
+
+  void image_creator::render_frame(char unsigned * buffer, std::span<point const> grid, double sl) const
+  {
+    run_tasks(grid.size() / width, [&](std::size_t i) {
+      char unsigned * row = buffer + i * width * 3;
+      for (point p : grid.subspan(i * width, width)) {
+	color c = std::isnan(p.x) || std::isnan(p.y) ? background : texture.color_at(texture_longitude(p.x, sl), p.y);
+	*row++ = c.red;
+	*row++ = c.green;
+	*row++ = c.blue;
+      }
+    });
+  }
+
+  bool image_creator::save_frames(std::string const & path, std::size_t frames, double longitude_step) const
+  {
+    std::size_t dot = path.find_last_of('.');
+    std::size_t slash = path.find_last_of('/');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+      dot = path.size();
+
+    std::vector<double> xs = projected_xs();
+    std::vector<point> grid;
+    {
+      profiler::scope phase { prof, "invert" };
+      grid = inverse_grid(xs, 0, height);
+    }
+    std::size_t constexpr buffer_count = 3;
+    std::array<std::unique_ptr<char unsigned[]>, buffer_count> buffers;
+    std::array<std::future<bool>, buffer_count> pending;
+    bool written = true;
+    for (std::size_t f = 0; f < frames; ++f) {
+      std::size_t k = f % buffer_count;
+      if (pending[k].valid())
+	written = pending[k].get() && written;
+      if (!buffers[k])
+	buffers[k] = std::make_unique<char unsigned[]>(width * height * 3);
+      {
+	profiler::scope phase { prof, "gather" };
+	render_frame(buffers[k].get(), grid, standard_longitude + f * longitude_step);
+      }
+      clip_rows(buffers[k].get(), 0, height, xs);
+
+      char number[32];
+      std::snprintf(number, sizeof number, "-%04zu", f);
+      std::string frame_path = path.substr(0, dot) + number + path.substr(dot);
+      pending[k] = std::async(std::launch::async, [this, buffer = buffers[k].get(), frame_path] {
+	return write_image(frame_path, buffer);
+      });
+    }
+    for (std::future<bool> & p : pending)
+      if (p.valid())
+	written = p.get() && written;
+    return written;
+  }
+
+  namespace
+  {
+    double wrap_longitude(double x)
+    {
+      if (x < -std::numbers::pi)
+	x += 2 * std::numbers::pi;
+      if (x >= std::numbers::pi)
+	x -= 2 * std::numbers::pi;
+      return x;
+    }
+
+    double longitude_distance(double a, double b)
+    {
+      double d = std::abs(a - b);
+      return d > std::numbers::pi ? 2 * std::numbers::pi - d : d;
+    }
+
+    bool on_map(point p)
+    {
+      return !std::isnan(p.x) && !std::isnan(p.y);
+    }
+  }
+
+  // Estimates what a render will sample from the texture by inverting
+  // every pixel of 65 evenly spaced rows and 65 evenly spaced columns.
+  // Longitudes are marked in 1-degree bins along the pixel paths, and the
+  // bounds are widened by the largest difference between neighbouring
+  // sampled rows or columns, so that features between them are kept.  A
+  // longitude range that crosses the texture seam is left whole.  The
+  // resolution is the smaller of the smallest steps between horizontal
+  // and vertical neighbours, which never exceeds any pixel's footprint.
+  texture_region sampled_texture_region(projection const & proj, viewport const & view, std::size_t width, std::size_t height, double standard_longitude)
+  {
+    texture_region region;
+    if (width < 2 || height < 2)
+      return region;
+    std::size_t constexpr lines = 64;
+    std::size_t constexpr bins = 360;
+    double constexpr pi = std::numbers::pi;
+    double constexpr bin_width = 2 * pi / bins;
+
+    auto sample = [&](std::size_t x, std::size_t y) {
+      point p = proj.invert(x * view.width() / (width - 1) + view.x_min, y * view.height() / (height - 1) + view.y_min);
+      if (on_map(p))
+	p.x = wrap_longitude(p.x + standard_longitude);
+      return p;
+    };
+    std::vector<std::vector<point>> rows(lines + 1, std::vector<point>(width));
+    std::vector<std::vector<point>> columns(lines + 1, std::vector<point>(height));
+    for (std::size_t l = 0; l <= lines; ++l) {
+      std::size_t y = l * (height - 1) / lines;
+      for (std::size_t x = 0; x < width; ++x)
+	rows[l][x] = sample(x, y);
+      std::size_t x = l * (width - 1) / lines;
+      for (std::size_t y = 0; y < height; ++y)
+	columns[l][y] = sample(x, y);
+    }
+
+    std::array<bool, bins> covered { };
+    auto bin = [](double longitude) {
+      return std::min(static_cast<std::size_t>((longitude + pi) / bin_width), bins - 1);
+    };
+    auto cover = [&](point p, point q) {
+      std::size_t i = bin(p.x);
+      std::size_t j = bin(q.x);
+      bool forward = wrap_longitude(q.x - p.x) >= 0;
+      covered[i] = true;
+      while (i != j) {
+	i = forward ? (i + 1) % bins : (i + bins - 1) % bins;
+	covered[i] = true;
+      }
+    };
+    double latitude_min = std::numeric_limits<double>::infinity();
+    double latitude_max = -std::numeric_limits<double>::infinity();
+    auto trace = [&](std::vector<point> const & line, double & step) {
+      for (std::size_t i = 0; i < line.size(); ++i) {
+	point p = line[i];
+	if (!on_map(p))
+	  continue;
+	latitude_min = std::min(latitude_min, p.y);
+	latitude_max = std::max(latitude_max, p.y);
+	if (i + 1 < line.size() && on_map(line[i + 1])) {
+	  point q = line[i + 1];
+	  cover(p, q);
+	  step = std::min(step, std::max(longitude_distance(p.x, q.x), std::abs(p.y - q.y)));
+	} else {
+	  cover(p, p);
+	}
+      }
+    };
+    double longitude_margin = 0;
+    double latitude_margin = 0;
+    auto compare = [&](std::vector<point> const & a, std::vector<point> const & b) {
+      for (std::size_t i = 0; i < a.size(); ++i) {
+	if (!on_map(a[i]) || !on_map(b[i]))
+	  continue;
+	longitude_margin = std::max(longitude_margin, longitude_distance(a[i].x, b[i].x));
+	latitude_margin = std::max(latitude_margin, std::abs(a[i].y - b[i].y));
+      }
+    };
+    double step_x = std::numeric_limits<double>::infinity();
+    double step_y = std::numeric_limits<double>::infinity();
+    for (std::size_t l = 0; l <= lines; ++l) {
+      trace(rows[l], step_x);
+      trace(columns[l], step_y);
+      if (l > 0) {
+	compare(rows[l - 1], rows[l]);
+	compare(columns[l - 1], columns[l]);
+      }
+    }
+    if (latitude_min > latitude_max)
+      return region;
+
+    double resolution = std::min(step_x, step_y);
+    region.resolution = std::isinf(resolution) ? 0 : resolution;
+    region.latitude_min = std::max(-pi * 0.5, latitude_min - latitude_margin - bin_width);
+    region.latitude_max = std::min(pi * 0.5, latitude_max + latitude_margin + bin_width);
+
+    std::size_t gap_begin = 0;
+    std::size_t gap_length = 0;
+    for (std::size_t i = 0; i < bins; ++i) {
+      std::size_t length = 0;
+      while (length < bins && !covered[(i + length) % bins])
+	++length;
+      if (length > gap_length) {
+	gap_begin = i;
+	gap_length = length;
+      }
+    }
+    std::size_t pad = 1 + static_cast<std::size_t>(std::ceil(longitude_margin / bin_width));
+    if (gap_length > 2 * pad) {
+      std::size_t arc_begin = (gap_begin + gap_length + bins - pad) % bins;
+      std::size_t arc_length = bins - gap_length + 2 * pad;
+      if (arc_begin + arc_length <= bins) {
+	region.longitude_min = -pi + arc_begin * bin_width;
+	region.longitude_max = -pi + (arc_begin + arc_length) * bin_width;
       }
     }
-    stbi_write_jpg(path.c_str(), width, height, 3, buffer.get(), jpeg_quality);
+    return region;
   }
 }
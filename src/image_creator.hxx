@@ -1,38 +1,145 @@
 #ifndef MKWORLDMAP_IMAGE_CREATOR_HXX_2024_03_18_3PBXYX3HRRRY
 #define MKWORLDMAP_IMAGE_CREATOR_HXX_2024_03_18_3PBXYX3HRRRY
 
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "earth_texture.hxx"
+#include "image_writer.hxx"
 #include "projection.hxx"
+#include "profiler.hxx"
+#include "remap_table.hxx"
 
 namespace mkworldmap
 {
   class image_creator
   {
 
+    struct tile_range
+    {
+      std::size_t x_begin;
+      std::size_t x_end;
+      std::size_t i_begin;
+      std::size_t i_end;
+    };
+
     std::size_t width;
     std::size_t height;
     double standard_longitude;
     bool south_up;
     earth_texture const & texture;
     projection const & proj;
+    viewport view;
+    std::size_t threads;
+    std::size_t antialiasing = 1;
+    double approximation = 0;
+    profiler * prof = nullptr;
+    image_options output;
+    std::FILE * output_stream = nullptr;
 
-    color color_at(double, double) const;
+    double projected_x(double) const;
+    double projected_y(double) const;
+    double texture_longitude(double) const;
+    double texture_longitude(double, double) const;
+    color color_at(point) const;
+    color color_at(point, double) const;
+    std::pair<std::size_t, std::size_t> domain_range(std::span<double const>, double) const;
+    void invert_span(std::span<double const>, double, std::span<point>) const;
+    void fill_background(char unsigned *, std::size_t) const;
+    void render_row(char unsigned *, std::size_t, std::span<double const>, std::span<point>) const;
+    std::vector<std::size_t> texture_columns(std::span<double const>) const;
+    std::size_t texture_row(std::size_t) const;
+    void render_separable_row(char unsigned *, std::size_t, std::span<std::size_t const>) const;
+    void remap_row(std::span<std::uint32_t>, std::size_t, std::span<double const>, std::span<point>) const;
+    void remap_separable_row(std::span<std::uint32_t>, std::size_t, std::span<std::size_t const>) const;
+    void render_remapped_row(char unsigned *, std::span<std::uint32_t const>) const;
+    std::vector<double> projected_xs() const;
+    std::size_t tile_count(std::size_t) const;
+    tile_range tile_at(std::size_t, std::size_t, std::size_t) const;
+    void for_each_tile_row(std::size_t, std::size_t, std::size_t, std::function<void(std::size_t, std::size_t, std::size_t)> const &) const;
+    void for_each_clipped(std::size_t, std::size_t, std::span<double const>, std::function<void(std::size_t, std::size_t)> const &) const;
+    void clip_rows(char unsigned *, std::size_t, std::size_t, std::span<double const>) const;
+    void run_tasks(std::size_t, std::function<void(std::size_t)> const &) const;
+    void render_rows(char unsigned *, std::size_t, std::size_t, std::span<double const>, std::span<std::size_t const>) const;
+    void render_profiled_rows(char unsigned *, std::size_t, std::size_t, std::span<double const>) const;
+    double texel_distance(point, point) const;
+    bool needs_refinement(point, point, point) const;
+    double footprint(point, point, point) const;
+    color supersample(double, double, double) const;
+    void render_filtered_tile(char unsigned *, std::size_t, tile_range, std::span<double const>) const;
+    std::size_t approximate_tile(tile_range, std::span<double const>, std::span<point>) const;
+    void render_approximate_tile(char unsigned *, std::size_t, std::size_t, tile_range, std::span<double const>) const;
+    void remap_approximate_tile(remap_table &, tile_range, std::span<double const>) const;
+    std::size_t texel_difference(point, point) const;
+    void render_remapped_rows(char unsigned *, std::size_t, std::size_t, remap_table const &) const;
+    std::unique_ptr<image_writer> open_writer(std::string const &) const;
+    bool write_image(std::string const &, char unsigned const *) const;
+    std::vector<point> inverse_grid(std::span<double const>, std::size_t, std::size_t) const;
+    void render_frame(char unsigned *, std::span<point const>, double) const;
+    bool write_strips(std::string const &, std::size_t, std::function<void(char unsigned *, std::size_t, std::size_t)> const &) const;
 
-    static int constexpr jpeg_quality = 85;
+    static std::size_t constexpr tile_size = 32;
+    static color constexpr background { 0xaa, 0xaa, 0xaa };
+    static std::size_t constexpr no_texel = static_cast<std::size_t>(-1);
+    static std::size_t constexpr profile_block_rows = 256;
     
   public:
+    // Larger sample counts are clamped; each refined pixel costs the
+    // square of this many inversions.
+    static std::size_t constexpr max_antialiasing = 16;
+
+    struct approximation_error
+    {
+      std::size_t inversions;
+      std::size_t pixels;
+      std::size_t max_texel_difference;
+    };
+
     image_creator() = delete;
     image_creator(image_creator const &) = default;
     image_creator(image_creator &&) = default;
     image_creator & operator=(image_creator const &) = default;
     image_creator & operator=(image_creator &&) = default;
-    image_creator(earth_texture const &, projection const &, std::size_t, double, bool = false);
+    image_creator(earth_texture const &, projection const &, std::size_t, double, bool = false, std::size_t = 1);
+    image_creator(earth_texture const &, projection const &, viewport, std::size_t, std::size_t, double, bool = false, std::size_t = 1);
+
+    void set_antialiasing(std::size_t);
+    // Inverts non-separable projections exactly only on an adaptive grid
+    // and interpolates between, keeping the error within this many
+    // texels.  Cells are checked at their centre and edge midpoints against
+    // half of it, which leaves room for the error between them.  0 turns it
+    // off.
+    void set_approximation(double);
+    void set_profiler(profiler *);
+    void set_output_options(image_options const &);
+    // When set, images are written to this stream instead of their path.
+    void set_output_stream(std::FILE *);
 
-    void save_image(std::string const & path) const;
+    std::size_t image_width() const;
+    std::size_t image_height() const;
+
+    remap_table make_remap_table() const;
+    std::size_t max_texel_difference(projection const &, std::size_t = 1) const;
+    approximation_error measure_approximation() const;
+    // The work of an iterative inverse over every pixel on the map.
+    inverse_statistics measure_iterations() const;
+
+    void render(char unsigned * buffer) const;
+
+    bool save_image(std::string const & path) const;
+    bool save_image(std::string const & path, remap_table const & table) const;
+    bool stream_image(std::string const & path, std::size_t strip_height) const;
+    bool stream_image(std::string const & path, remap_table const & table, std::size_t strip_height) const;
+    bool save_frames(std::string const & path, std::size_t frames, double longitude_step) const;
     
   };
+
+  texture_region sampled_texture_region(projection const &, viewport const &, std::size_t, std::size_t, double);
 }
 
 #endif
@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <jpeglib.h>
+#include <png.h>
+
+#include "image_writer.hxx"
+#include "parallel.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    // Files the writer opened are closed with it; the standard output and
+    // files passed in by the caller are only flushed.
+    using output_file = std::unique_ptr<std::FILE, int (*)(std::FILE *)>;
+
+    output_file open_output(std::string const & path)
+    {
+      if (path == "-")
+	return output_file { stdout, std::fflush };
+      return output_file { std::fopen(path.c_str(), "wb"), std::fclose };
+    }
+
+    bool write_bytes(std::FILE * file, char unsigned const * bytes, std::size_t size)
+    {
+      return std::fwrite(bytes, 1, size, file) == size;
+    }
+
+    struct jpeg_error_manager
+    {
+      jpeg_error_mgr manager;
+      std::jmp_buf jump_buffer;
+    };
+
+    void jpeg_error_exit(j_common_ptr cinfo)
+    {
+      std::longjmp(reinterpret_cast<jpeg_error_manager *>(cinfo->err)->jump_buffer, 1);
+    }
+
+    // Stripes are a whole number of 16-row MCUs so that every stripe but
+    // the last ends on an MCU boundary.  The height is fixed, so the file
+    // is the same for any thread count.
+    std::size_t constexpr jpeg_mcu_size = 16;
+    std::size_t constexpr jpeg_stripe_height = 8 * jpeg_mcu_size;
+
+    // Encodes rows as a standalone baseline JPEG in memory.  Every stripe
+    // uses the same settings and the standard Huffman tables, so the
+    // entropy-coded segments of separate stripes can be joined with
+    // restart markers under the header of the first.
+    class jpeg_stripe_encoder
+    {
+      jpeg_compress_struct cinfo;
+      jpeg_error_manager error;
+      char unsigned * output = nullptr;
+      unsigned long size = 0;
+
+    public:
+      jpeg_stripe_encoder();
+      jpeg_stripe_encoder(jpeg_stripe_encoder const &) = delete;
+      jpeg_stripe_encoder(jpeg_stripe_encoder &&) = delete;
+      jpeg_stripe_encoder & operator=(jpeg_stripe_encoder const &) = delete;
+      jpeg_stripe_encoder & operator=(jpeg_stripe_encoder &&) = delete;
+      ~jpeg_stripe_encoder();
+
+      bool encode(char unsigned const *, std::size_t, std::size_t, int);
+      std::span<char unsigned const> bytes() const;
+    };
+
+    jpeg_stripe_encoder::jpeg_stripe_encoder()
+    {
+      cinfo.err = jpeg_std_error(&error.manager);
+      error.manager.error_exit = jpeg_error_exit;
+      jpeg_create_compress(&cinfo);
+    }
+
+    jpeg_stripe_encoder::~jpeg_stripe_encoder()
+    {
+      jpeg_destroy_compress(&cinfo);
+      std::free(output);
+    }
+
+    bool jpeg_stripe_encoder::encode(char unsigned const * rows, std::size_t width, std::size_t height, int quality)
+    {
+      if (setjmp(error.jump_buffer))
+	return false;
+      jpeg_mem_dest(&cinfo, &output, &size);
+      cinfo.image_width = width;
+      cinfo.image_height = height;
+      cinfo.input_components = 3;
+      cinfo.in_color_space = JCS_RGB;
+      jpeg_set_defaults(&cinfo);
+      jpeg_set_quality(&cinfo, quality, TRUE);
+      cinfo.comp_info[0].h_samp_factor = 2;
+      cinfo.comp_info[0].v_samp_factor = 2;
+      for (int c = 1; c < 3; ++c) {
+	cinfo.comp_info[c].h_samp_factor = 1;
+	cinfo.comp_info[c].v_samp_factor = 1;
+      }
+      jpeg_start_compress(&cinfo, TRUE);
+      for (std::size_t i = 0; i < height; ++i) {
+	JSAMPROW row = const_cast<JSAMPLE *>(rows + i * width * 3);
+	jpeg_write_scanlines(&cinfo, &row, 1);
+      }
+      jpeg_finish_compress(&cinfo);
+      return true;
+    }
+
+    std::span<char unsigned const> jpeg_stripe_encoder::bytes() const
+    {
+      return { output, size };
+    }
+
+    // Offsets of the SOF0 and SOS segments and of the entropy-coded data
+    // that follows the SOS header.
+    struct jpeg_layout
+    {
+      std::size_t frame = 0;
+      std::size_t scan_header = 0;
+      std::size_t scan = 0;
+    };
+
+    bool find_jpeg_layout(std::span<char unsigned const> bytes, jpeg_layout & layout)
+    {
+      std::size_t i = 2;
+      while (i + 4 <= bytes.size() && bytes[i] == 0xff) {
+	char unsigned marker = bytes[i + 1];
+	std::size_t length = bytes[i + 2] << 8 | bytes[i + 3];
+	if (marker == 0xc0)
+	  layout.frame = i;
+	if (marker == 0xda) {
+	  layout.scan_header = i;
+	  layout.scan = i + 2 + length;
+	  return layout.frame != 0 && layout.scan + 2 <= bytes.size();
+	}
+	i += 2 + length;
+      }
+      return false;
+    }
+
+    // Encodes stripes of jpeg_stripe_height rows on up to threads workers
+    // and writes them in order.  The first stripe brings the header, with
+    // the full image height and a DRI segment whose interval is one
+    // stripe; each later stripe is preceded by the next RSTn marker.
+    class jpeg_writer : public image_writer
+    {
+      output_file file;
+      std::size_t width;
+      std::size_t height;
+      int quality;
+      std::size_t threads;
+      std::vector<char unsigned> pending;
+      std::size_t rows_received = 0;
+      std::size_t stripes_written = 0;
+      bool failed = false;
+
+      bool encode(char unsigned const *, std::size_t);
+      bool write_stripe(std::span<char unsigned const>);
+
+    public:
+      jpeg_writer(output_file, std::size_t, std::size_t, int, std::size_t);
+      ~jpeg_writer() override;
+
+      bool write_rows(char unsigned const *, std::size_t) override;
+      bool finish() override;
+    };
+
+    jpeg_writer::jpeg_writer(output_file file, std::size_t width, std::size_t height, int quality, std::size_t threads)
+      : file { std::move(file) },
+	width { width },
+	height { height },
+	quality { quality },
+	threads { std::max<std::size_t>(threads, 1) }
+    {
+    }
+
+    jpeg_writer::~jpeg_writer() = default;
+
+    bool jpeg_writer::encode(char unsigned const * rows, std::size_t count)
+    {
+      std::size_t stripes = (count + jpeg_stripe_height - 1) / jpeg_stripe_height;
+      std::vector<std::unique_ptr<jpeg_stripe_encoder>> encoders(stripes);
+      std::vector<char> encoded(stripes);
+      parallel_for(stripes, threads, [&](std::size_t s) {
+	std::size_t first = s * jpeg_stripe_height;
+	encoders[s] = std::make_unique<jpeg_stripe_encoder>();
+	encoded[s] = encoders[s]->encode(rows + first * width * 3, width, std::min(jpeg_stripe_height, count - first), quality);
+      });
+      for (std::size_t s = 0; s < stripes; ++s)
+	if (!encoded[s] || !write_stripe(encoders[s]->bytes()))
+	  return false;
+      return true;
+    }
+
+    bool jpeg_writer::write_stripe(std::span<char unsigned const> bytes)
+    {
+      jpeg_layout layout;
+      if (!find_jpeg_layout(bytes, layout))
+	return false;
+      std::span<char unsigned const> data = bytes.subspan(layout.scan, bytes.size() - 2 - layout.scan);
+      if (stripes_written++ > 0) {
+	char unsigned restart[] = { 0xff, static_cast<char unsigned>(0xd0 + (stripes_written - 2) % 8) };
+	return write_bytes(file.get(), restart, sizeof restart) && write_bytes(file.get(), data.data(), data.size());
+      }
+      // libjpeg checks the width of each stripe, but only sees stripe
+      // heights; the full height, patched in here, has the same limit.
+      if (height > JPEG_MAX_DIMENSION)
+	return false;
+      std::vector<char unsigned> header(bytes.begin(), bytes.begin() + layout.scan_header);
+      header[layout.frame + 5] = height >> 8;
+      header[layout.frame + 6] = height & 0xff;
+      if (height > jpeg_stripe_height) {
+	std::size_t interval = (width + jpeg_mcu_size - 1) / jpeg_mcu_size * (jpeg_stripe_height / jpeg_mcu_size);
+	header.insert(header.end(), { 0xff, 0xdd, 0x00, 0x04, static_cast<char unsigned>(interval >> 8), static_cast<char unsigned>(interval & 0xff) });
+      }
+      header.insert(header.end(), bytes.begin() + layout.scan_header, bytes.begin() + layout.scan);
+      return write_bytes(file.get(), header.data(), header.size()) && write_bytes(file.get(), data.data(), data.size());
+    }
+
+    bool jpeg_writer::write_rows(char unsigned const * rows, std::size_t count)
+    {
+      if (failed)
+	return false;
+      std::size_t stride = width * 3;
+      count = std::min(count, height - rows_received);
+      while (count > 0) {
+	bool last = rows_received + count == height;
+	if (pending.empty() && (count >= jpeg_stripe_height || last)) {
+	  std::size_t direct = last ? count : count - count % jpeg_stripe_height;
+	  if (!encode(rows, direct)) {
+	    failed = true;
+	    return false;
+	  }
+	  rows += direct * stride;
+	  count -= direct;
+	  rows_received += direct;
+	  continue;
+	}
+	std::size_t take = std::min(count, jpeg_stripe_height - pending.size() / stride);
+	pending.insert(pending.end(), rows, rows + take * stride);
+	rows += take * stride;
+	count -= take;
+	rows_received += take;
+	if (pending.size() / stride == jpeg_stripe_height || rows_received == height) {
+	  if (!encode(pending.data(), pending.size() / stride)) {
+	    failed = true;
+	    return false;
+	  }
+	  pending.clear();
+	}
+      }
+      return true;
+    }
+
+    bool jpeg_writer::finish()
+    {
+      if (failed || rows_received != height)
+	return false;
+      char unsigned constexpr end[] = { 0xff, 0xd9 };
+      return write_bytes(file.get(), end, sizeof end) && std::fflush(file.get()) == 0;
+    }
+
+    class png_writer : public image_writer
+    {
+      output_file file;
+      png_structp png;
+      png_infop info;
+      std::size_t width;
+      bool failed = false;
+
+    public:
+      png_writer(output_file, std::size_t, std::size_t, int);
+      ~png_writer() override;
+
+      bool write_rows(char unsigned const *, std::size_t) override;
+      bool finish() override;
+    };
+
+    png_writer::png_writer(output_file file, std::size_t width, std::size_t height, int level)
+      : file { std::move(file) },
+	png { png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr) },
+	info { png ? png_create_info_struct(png) : nullptr },
+	width { width }
+    {
+      if (!png || !info || setjmp(png_jmpbuf(png))) {
+	failed = true;
+	return;
+      }
+      png_init_io(png, this->file.get());
+      if (level >= 0)
+	png_set_compression_level(png, std::min(level, 9));
+      png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+      png_write_info(png, info);
+    }
+
+    png_writer::~png_writer()
+    {
+      png_destroy_write_struct(&png, &info);
+    }
+
+    bool png_writer::write_rows(char unsigned const * rows, std::size_t count)
+    {
+      if (failed)
+	return false;
+      if (setjmp(png_jmpbuf(png))) {
+	failed = true;
+	return false;
+      }
+      for (std::size_t i = 0; i < count; ++i)
+	png_write_row(png, rows + i * width * 3);
+      return true;
+    }
+
+    bool png_writer::finish()
+    {
+      if (failed)
+	return false;
+      if (setjmp(png_jmpbuf(png))) {
+	failed = true;
+	return false;
+      }
+      png_write_end(png, info);
+      return std::fflush(file.get()) == 0;
+    }
+
+    // Binary PPM (P6) or PAM (P7): a text header followed by raw RGB rows.
+    class netpbm_writer : public image_writer
+    {
+      output_file file;
+      std::size_t width;
+      bool failed = false;
+
+    public:
+      netpbm_writer(output_file, std::size_t, std::size_t, image_format);
+      ~netpbm_writer() override;
+
+      bool write_rows(char unsigned const *, std::size_t) override;
+      bool finish() override;
+    };
+
+    netpbm_writer::netpbm_writer(output_file file, std::size_t width, std::size_t height, image_format format)
+      : file { std::move(file) },
+	width { width }
+    {
+      int written = format == image_format::pam
+	? std::fprintf(this->file.get(), "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n", width, height)
+	: std::fprintf(this->file.get(), "P6\n%zu %zu\n255\n", width, height);
+      failed = written < 0;
+    }
+
+    netpbm_writer::~netpbm_writer() = default;
+
+    bool netpbm_writer::write_rows(char unsigned const * rows, std::size_t count)
+    {
+      if (failed || !write_bytes(file.get(), rows, count * width * 3))
+	failed = true;
+      return !failed;
+    }
+
+    bool netpbm_writer::finish()
+    {
+      return !failed && std::fflush(file.get()) == 0;
+    }
+
+    // The Quite OK Image format, with three channels.  The encoder state
+    // carries over between calls, so rows can arrive in any grouping.  The
+    // specification's index starts out as transparent black, which no
+    // opaque pixel matches; indexed marks the slots written since.
+    class qoi_writer : public image_writer
+    {
+      using pixel = std::array<char unsigned, 3>;
+
+      output_file file;
+      std::size_t width;
+      std::array<pixel, 64> index { };
+      std::array<bool, 64> indexed { };
+      pixel previous { 0, 0, 0 };
+      std::size_t run = 0;
+      std::vector<char unsigned> output;
+      bool failed = false;
+
+      void flush_run();
+
+    public:
+      qoi_writer(output_file, std::size_t, std::size_t);
+      ~qoi_writer() override;
+
+      bool write_rows(char unsigned const *, std::size_t) override;
+      bool finish() override;
+    };
+
+    qoi_writer::qoi_writer(output_file file, std::size_t width, std::size_t height)
+      : file { std::move(file) },
+	width { width }
+    {
+      char unsigned header[14] = { 'q', 'o', 'i', 'f' };
+      for (int i = 0; i < 4; ++i) {
+	header[4 + i] = width >> (24 - 8 * i);
+	header[8 + i] = height >> (24 - 8 * i);
+      }
+      header[12] = 3;
+      header[13] = 0;
+      failed = !write_bytes(this->file.get(), header, sizeof header);
+    }
+
+    qoi_writer::~qoi_writer() = default;
+
+    void qoi_writer::flush_run()
+    {
+      if (run > 0)
+	output.push_back(0xc0 | (run - 1));
+      run = 0;
+    }
+
+    bool qoi_writer::write_rows(char unsigned const * rows, std::size_t count)
+    {
+      if (failed)
+	return false;
+      output.clear();
+      for (std::size_t i = 0; i < count * width; ++i) {
+	pixel p { rows[i * 3], rows[i * 3 + 1], rows[i * 3 + 2] };
+	if (p == previous) {
+	  if (++run == 62)
+	    flush_run();
+	  continue;
+	}
+	flush_run();
+	std::size_t hash = (p[0] * 3 + p[1] * 5 + p[2] * 7 + 255 * 11) % 64;
+	if (indexed[hash] && index[hash] == p) {
+	  output.push_back(hash);
+	} else {
+	  index[hash] = p;
+	  indexed[hash] = true;
+	  int dr = static_cast<signed char>(p[0] - previous[0]);
+	  int dg = static_cast<signed char>(p[1] - previous[1]);
+	  int db = static_cast<signed char>(p[2] - previous[2]);
+	  int dr_dg = dr - dg;
+	  int db_dg = db - dg;
+	  if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+	    output.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+	  } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+	    output.push_back(0x80 | (dg + 32));
+	    output.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+	  } else {
+	    output.insert(output.end(), { 0xfe, p[0], p[1], p[2] });
+	  }
+	}
+	previous = p;
+      }
+      failed = !write_bytes(file.get(), output.data(), output.size());
+      return !failed;
+    }
+
+    bool qoi_writer::finish()
+    {
+      if (failed)
+	return false;
+      output.clear();
+      flush_run();
+      output.insert(output.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+      return write_bytes(file.get(), output.data(), output.size()) && std::fflush(file.get()) == 0;
+    }
+
+    template <typename Writer, typename ... Arguments>
+    std::unique_ptr<image_writer> make_writer(output_file file, Arguments ... arguments)
+    {
+      if (!file)
+	return std::unique_ptr<image_writer> { };
+      return std::make_unique<Writer>(std::move(file), arguments ...);
+    }
+
+    std::unique_ptr<image_writer> make_image_writer(output_file file, std::size_t width, std::size_t height, image_options const & options)
+    {
+      switch (options.format) {
+      case image_format::png:
+	return make_writer<png_writer>(std::move(file), width, height, options.png_level);
+      case image_format::ppm:
+      case image_format::pam:
+	return make_writer<netpbm_writer>(std::move(file), width, height, options.format);
+      case image_format::qoi:
+	return make_writer<qoi_writer>(std::move(file), width, height);
+      case image_format::jpeg:
+	break;
+      }
+      return make_writer<jpeg_writer>(std::move(file), width, height, options.jpeg_quality, options.threads);
+    }
+
+    bool ends_with(std::string const & s, std::string_view suffix)
+    {
+      if (s.size() < suffix.size())
+	return false;
+      return std::equal(suffix.begin(), suffix.end(), s.end() - suffix.size(), [](char a, char b) {
+	return a == std::tolower(static_cast<char unsigned>(b));
+      });
+    }
+  }
+
+  bool parse_image_format(std::string_view name, image_format & format)
+  {
+    if (name == "jpeg" || name == "jpg")
+      format = image_format::jpeg;
+    else if (name == "png")
+      format = image_format::png;
+    else if (name == "ppm")
+      format = image_format::ppm;
+    else if (name == "pam")
+      format = image_format::pam;
+    else if (name == "qoi")
+      format = image_format::qoi;
+    else
+      return false;
+    return true;
+  }
+
+  image_format image_format_for_path(std::string const & path)
+  {
+    if (ends_with(path, ".png"))
+      return image_format::png;
+    if (ends_with(path, ".ppm"))
+      return image_format::ppm;
+    if (ends_with(path, ".pam"))
+      return image_format::pam;
+    if (ends_with(path, ".qoi"))
+      return image_format::qoi;
+    return image_format::jpeg;
+  }
+
+  std::unique_ptr<image_writer> make_jpeg_writer(std::string const & path, std::size_t width, std::size_t height, int quality, std::size_t threads)
+  {
+    return make_writer<jpeg_writer>(open_output(path), width, height, quality, threads);
+  }
+
+  std::unique_ptr<image_writer> make_png_writer(std::string const & path, std::size_t width, std::size_t height, int level)
+  {
+    return make_writer<png_writer>(open_output(path), width, height, level);
+  }
+
+  std::unique_ptr<image_writer> make_netpbm_writer(std::string const & path, std::size_t width, std::size_t height, image_format format)
+  {
+    return make_writer<netpbm_writer>(open_output(path), width, height, format);
+  }
+
+  std::unique_ptr<image_writer> make_qoi_writer(std::string const & path, std::size_t width, std::size_t height)
+  {
+    return make_writer<qoi_writer>(open_output(path), width, height);
+  }
+
+  std::unique_ptr<image_writer> make_image_writer(std::string const & path, std::size_t width, std::size_t height, image_options const & options)
+  {
+    return make_image_writer(open_output(path), width, height, options);
+  }
+
+  std::unique_ptr<image_writer> make_image_writer(std::FILE * file, std::size_t width, std::size_t height, image_options const & options)
+  {
+    return make_image_writer(output_file { file, std::fflush }, width, height, options);
+  }
+
+}
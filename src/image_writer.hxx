@@ -0,0 +1,59 @@
+#ifndef MKWORLDMAP_IMAGE_WRITER_HXX_2026_10_17_B5NW2RXE9KCF
+#define MKWORLDMAP_IMAGE_WRITER_HXX_2026_10_17_B5NW2RXE9KCF
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace mkworldmap
+{
+  class image_writer
+  {
+  public:
+    image_writer() = default;
+    image_writer(image_writer const &) = delete;
+    image_writer(image_writer &&) = delete;
+    image_writer & operator=(image_writer const &) = delete;
+    image_writer & operator=(image_writer &&) = delete;
+    virtual ~image_writer() = default;
+
+    virtual bool write_rows(char unsigned const *, std::size_t) = 0;
+    virtual bool finish() = 0;
+  };
+
+  enum class image_format
+  {
+    jpeg,
+    png,
+    ppm,
+    pam,
+    qoi
+  };
+
+  // png_level is a zlib level from 0 to 9, or -1 for the libpng default.
+  // threads only affects the JPEG encoder, whose output does not depend
+  // on it.
+  struct image_options
+  {
+    image_format format = image_format::jpeg;
+    int jpeg_quality = 85;
+    int png_level = -1;
+    std::size_t threads = 1;
+  };
+
+  bool parse_image_format(std::string_view, image_format &);
+  image_format image_format_for_path(std::string const &);
+
+  // A path of "-" writes to the standard output.
+  std::unique_ptr<image_writer> make_jpeg_writer(std::string const &, std::size_t, std::size_t, int, std::size_t = 1);
+  std::unique_ptr<image_writer> make_png_writer(std::string const &, std::size_t, std::size_t, int = -1);
+  std::unique_ptr<image_writer> make_netpbm_writer(std::string const &, std::size_t, std::size_t, image_format);
+  std::unique_ptr<image_writer> make_qoi_writer(std::string const &, std::size_t, std::size_t);
+  std::unique_ptr<image_writer> make_image_writer(std::string const &, std::size_t, std::size_t, image_options const &);
+
+  // Writes to a file the caller keeps open; the writer only flushes it.
+  std::unique_ptr<image_writer> make_image_writer(std::FILE *, std::size_t, std::size_t, image_options const &);
+}
+
+#endif
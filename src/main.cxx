@@ -1,12 +1,28 @@
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numbers>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "earth_texture.hxx"
 #include "projection.hxx"
 #include "image_creator.hxx"
+#include "image_writer.hxx"
+#include "tile_pyramid.hxx"
+#include "parallel.hxx"
+#include "profiler.hxx"
+#include "render_server.hxx"
 #include "main.hxx"
 
 namespace mkworldmap
@@ -53,32 +69,34 @@ namespace mkworldmap
     return option_value ? option_value : "./res/world.topo.bathy.200412.3x5400x2700.jpg";
   }
 
-  projection_method get_projection_method(int argc, char const * argv[])
-  {
-    char const * method = get_command_line_option("-p", "--projection", argc, argv);
-    return !method ? projection_method::invalid
-      : std::strcmp(method, "equirectangular") == 0 ? projection_method::equirectangular
-      : std::strcmp(method, "cylindrical-equal-area") == 0 ? projection_method::cylindrical_equal_area
-      : std::strcmp(method, "mercator") == 0 ? projection_method::mercator
-      : std::strcmp(method, "miller") == 0 ? projection_method::miller
-      : std::strcmp(method, "central-cylindrical") == 0 ? projection_method::central_cylindrical
-      : std::strcmp(method, "sinusoidal") == 0 ? projection_method::sinusoidal
-      : std::strcmp(method, "mollweide") == 0 ? projection_method::mollweide
-      : std::strcmp(method, "azimuthal-equidistant") == 0 ? projection_method::azimuthal_equidistant
-      : std::strcmp(method, "aitoff") == 0 ? projection_method::aitoff
-      : std::strcmp(method, "orthographic") == 0 ? projection_method::orthographic
-      : std::strcmp(method, "orthographic-aitoff") == 0 ? projection_method::orthographic_aitoff
-      : std::strcmp(method, "lambert-azimuthal-equal-area") == 0 ? projection_method::lambert_azimuthal_equal_area
-      : std::strcmp(method, "hammer") == 0 ? projection_method::hammer
-      : std::strcmp(method, "gall-stereographic") == 0 ? projection_method::gall_stereographic
-      : std::strcmp(method, "eckert-1") == 0 ? projection_method::eckert_1
-      : std::strcmp(method, "eckert-2") == 0 ? projection_method::eckert_2
-      : std::strcmp(method, "eckert-3") == 0 ? projection_method::eckert_3
-      : std::strcmp(method, "eckert-4") == 0 ? projection_method::eckert_4
-      : std::strcmp(method, "eckert-5") == 0 ? projection_method::eckert_5
-      : std::strcmp(method, "eckert-6") == 0 ? projection_method::eckert_6
-      : std::strcmp(method, "collignon") == 0 ? projection_method::collignon
-      : projection_method::invalid;
+  char const * get_texture_cache_directory(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--texture-cache", argc, argv);
+  }
+
+  bool get_tiled_texture(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--tiled-texture", false, argc, argv);
+  }
+
+  bool get_mipmap(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--mipmap", false, argc, argv);
+  }
+
+  bool get_scaled_texture(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--scaled-texture", false, argc, argv);
+  }
+
+  bool get_cropped_texture(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--cropped-texture", false, argc, argv);
+  }
+
+  char const * get_projection_name(int argc, char const * argv[])
+  {
+    return get_command_line_option("-p", "--projection", argc, argv);
   }
 
   std::size_t get_output_image_width(int argc, char const * argv[])
@@ -96,12 +114,51 @@ namespace mkworldmap
     return get_boolean_command_line_option(nullptr, "--south-up", false, argc, argv);
   }
   
+  std::size_t get_thread_count(int argc, char const * argv[])
+  {
+    int threads = get_integral_command_line_option(nullptr, "--threads", 0, argc, argv);
+    return threads > 0 ? threads : default_thread_count();
+  }
+
+  std::size_t get_strip_height(int argc, char const * argv[])
+  {
+    int strip_height = get_integral_command_line_option(nullptr, "--strip-height", 0, argc, argv);
+    return strip_height > 0 ? strip_height : 0;
+  }
+
+  std::size_t get_antialiasing(int argc, char const * argv[])
+  {
+    int samples = get_integral_command_line_option(nullptr, "--antialias", 1, argc, argv);
+    return std::clamp<int>(samples, 1, image_creator::max_antialiasing);
+  }
+
   char const * get_output_path(int argc, char const * argv[])
   {
     char const * option_value = get_command_line_option("-o", "--output", argc, argv);
     return option_value ? option_value : "world-map.jpg";
   }
 
+  int get_jpeg_quality(int argc, char const * argv[])
+  {
+    return std::clamp(get_integral_command_line_option(nullptr, "--quality", 85, argc, argv), 1, 100);
+  }
+
+  int get_png_level(int argc, char const * argv[])
+  {
+    return std::clamp(get_integral_command_line_option(nullptr, "--png-level", -1, argc, argv), -1, 9);
+  }
+
+  bool get_image_options(image_options & options, int argc, char const * argv[])
+  {
+    options.format = image_format_for_path(get_output_path(argc, argv));
+    if (char const * format = get_command_line_option(nullptr, "--format", argc, argv))
+      if (!parse_image_format(format, options.format))
+	return false;
+    options.jpeg_quality = get_jpeg_quality(argc, argv);
+    options.png_level = get_png_level(argc, argv);
+    return true;
+  }
+
   double get_standard_latitude(int argc, char const * argv[])
   {
     return get_floating_command_line_option(nullptr, "--standard-latitude", 0.0, argc, argv);
@@ -112,46 +169,607 @@ namespace mkworldmap
     return get_floating_command_line_option(nullptr, "--max-latitude", 80.0, argc, argv);
   }
 
+  double get_center_latitude(int argc, char const * argv[])
+  {
+    return get_floating_command_line_option(nullptr, "--center-latitude", 0.0, argc, argv);
+  }
+
+  double get_rotation(int argc, char const * argv[])
+  {
+    return get_floating_command_line_option(nullptr, "--rotation", 0.0, argc, argv);
+  }
+
+  projection_parameters get_projection_parameters(int argc, char const * argv[])
+  {
+    return projection_parameters {
+      get_standard_latitude(argc, argv) * std::numbers::pi / 180,
+      get_max_latitude(argc, argv) * std::numbers::pi / 180,
+      get_center_latitude(argc, argv) * std::numbers::pi / 180,
+      get_rotation(argc, argv) * std::numbers::pi / 180
+    };
+  }
+
+  bool get_fast_math(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--fast-math", false, argc, argv);
+  }
+
+  std::size_t get_fast_math_tolerance(int argc, char const * argv[])
+  {
+    int tolerance = get_integral_command_line_option(nullptr, "--fast-math-tolerance", 1, argc, argv);
+    return tolerance > 0 ? tolerance : 0;
+  }
+
+  double get_approximation(int argc, char const * argv[])
+  {
+    return std::max(get_floating_command_line_option(nullptr, "--approximate", 0.0, argc, argv), 0.0);
+  }
+
+  std::unique_ptr<projection> make_fast_projection(image_creator const & exact, int argc, char const * argv[])
+  {
+    projection_parameters parameters = get_projection_parameters(argc, argv);
+    parameters.fast_math = true;
+    std::unique_ptr<projection> fast = make_projection(get_projection_name(argc, argv), parameters);
+    if (!fast->fast_math())
+      return nullptr;
+    std::size_t constexpr check_rows = 256;
+    std::size_t row_stride = std::max<std::size_t>(1, exact.image_height() / check_rows);
+    std::size_t difference = exact.max_texel_difference(*fast, row_stride);
+    if (difference > get_fast_math_tolerance(argc, argv)) {
+      if (difference == static_cast<std::size_t>(-1))
+	std::cerr << "WARNING: fast math is off because it changes which pixels are inside the map." << std::endl;
+      else
+	std::cerr << "WARNING: fast math is off because it moves texels by up to " << difference << " at this size." << std::endl;
+      return nullptr;
+    }
+    return fast;
+  }
+
+  char const * get_remap_cache_directory(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--remap-cache", argc, argv);
+  }
+
+  std::string get_remap_cache_path(char const * directory, earth_texture const & texture, int argc, char const * argv[])
+  {
+    std::ostringstream path;
+    path.precision(17);
+    path << directory << '/'
+	 << get_command_line_option("-p", "--projection", argc, argv)
+	 << "_sla" << get_standard_latitude(argc, argv)
+	 << "_mla" << get_max_latitude(argc, argv)
+	 << "_cla" << get_center_latitude(argc, argv)
+	 << "_rot" << get_rotation(argc, argv)
+	 << "_w" << get_output_image_width(argc, argv)
+	 << "_slo" << get_standard_longitude(argc, argv)
+	 << (get_south_up(argc, argv) ? "_s" : "_n")
+	 << "_t" << texture.grid_width() << 'x' << texture.grid_height()
+	 << (texture.grid_layout() == texture_layout::tiled ? "_tiled" : "")
+	 << (get_cropped_texture(argc, argv) ? "_cropped" : "")
+	 << (get_fast_math(argc, argv) ? "_fast" + std::to_string(get_fast_math_tolerance(argc, argv)) : "");
+    if (double approximation = get_approximation(argc, argv); approximation > 0)
+      path << "_a" << approximation;
+    if (char const * window = get_command_line_option(nullptr, "--viewport", argc, argv))
+      path << "_v" << window;
+    if (char const * bbox = get_command_line_option(nullptr, "--bbox", argc, argv))
+      path << "_b" << bbox;
+    if (char const * height = get_command_line_option(nullptr, "--height", argc, argv))
+      path << "_h" << height;
+    path << ".remap";
+    return path.str();
+  }
+
+  bool get_viewport(projection const & proj, viewport & view, int argc, char const * argv[])
+  {
+    view = proj.bounds();
+    if (char const * window = get_command_line_option(nullptr, "--viewport", argc, argv)) {
+      viewport v;
+      if (std::sscanf(window, "%lf,%lf,%lf,%lf", &v.x_min, &v.x_max, &v.y_min, &v.y_max) != 4 || !(v.x_min < v.x_max) || !(v.y_min < v.y_max))
+	return false;
+      view = v;
+    }
+    if (char const * bbox = get_command_line_option(nullptr, "--bbox", argc, argv)) {
+      double lon_min, lat_min, lon_max, lat_max;
+      if (std::sscanf(bbox, "%lf,%lf,%lf,%lf", &lon_min, &lat_min, &lon_max, &lat_max) != 4 || !(lat_min < lat_max))
+	return false;
+      double to_radian = std::numbers::pi / 180;
+      view = bounding_viewport(proj, lon_min * to_radian, lon_max * to_radian, lat_min * to_radian, lat_max * to_radian, get_standard_longitude(argc, argv) * to_radian);
+      if (std::isnan(view.x_min))
+	return false;
+    }
+    return true;
+  }
+
+  std::size_t get_output_image_height(viewport const & view, std::size_t width, int argc, char const * argv[])
+  {
+    int height = get_integral_command_line_option(nullptr, "--height", 0, argc, argv);
+    return height > 0 ? height : static_cast<std::size_t>(width * view.height() / view.width());
+  }
+
+  // Only a single render knows what it samples before the texture is
+  // loaded; jobs, tiles and the server share one texture, and frames turn
+  // the globe.
+  texture_region get_texture_region(int argc, char const * argv[])
+  {
+    texture_region region;
+    bool scaled = get_scaled_texture(argc, argv);
+    bool cropped = get_cropped_texture(argc, argv) && get_frame_count(argc, argv) == 0;
+    if (!(scaled || cropped) || get_jobs_path(argc, argv) || get_tiles_directory(argc, argv) || get_serve_path(argc, argv))
+      return region;
+    char const * proj_name = get_projection_name(argc, argv);
+    std::unique_ptr<projection> proj = proj_name ? make_projection(proj_name, get_projection_parameters(argc, argv)) : nullptr;
+    viewport view;
+    if (!proj || !get_viewport(*proj, view, argc, argv))
+      return region;
+    std::size_t width = get_output_image_width(argc, argv);
+    std::size_t height = get_output_image_height(view, width, argc, argv);
+    texture_region sampled = sampled_texture_region(*proj, view, width, height, get_standard_longitude(argc, argv) * std::numbers::pi / 180);
+    if (scaled)
+      region.resolution = sampled.resolution / get_antialiasing(argc, argv);
+    if (cropped) {
+      region.longitude_min = sampled.longitude_min;
+      region.longitude_max = sampled.longitude_max;
+      region.latitude_min = sampled.latitude_min;
+      region.latitude_max = sampled.latitude_max;
+    }
+    return region;
+  }
+
+  std::size_t get_frame_count(int argc, char const * argv[])
+  {
+    int frames = get_integral_command_line_option(nullptr, "--frames", 0, argc, argv);
+    return frames > 0 ? frames : 0;
+  }
+
+  double get_longitude_step(int argc, char const * argv[])
+  {
+    return get_floating_command_line_option(nullptr, "--longitude-step", 1.0, argc, argv);
+  }
+
+  char const * get_tiles_directory(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--tiles", argc, argv);
+  }
+
+  std::size_t get_max_zoom(int argc, char const * argv[])
+  {
+    int max_zoom = get_integral_command_line_option(nullptr, "--max-zoom", 3, argc, argv);
+    return max_zoom > 0 ? max_zoom : 0;
+  }
+
+  bool get_profile(int argc, char const * argv[])
+  {
+    return get_boolean_command_line_option(nullptr, "--profile", false, argc, argv);
+  }
+
+  char const * get_profile_json_path(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--profile-json", argc, argv);
+  }
+
+  char const * get_jobs_path(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--jobs", argc, argv);
+  }
+
+  std::size_t get_max_in_flight(int argc, char const * argv[])
+  {
+    int max_in_flight = get_integral_command_line_option(nullptr, "--max-in-flight", 2, argc, argv);
+    return max_in_flight > 0 ? max_in_flight : 1;
+  }
+
+  char const * get_serve_path(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--serve", argc, argv);
+  }
+
+  char const * get_connect_path(int argc, char const * argv[])
+  {
+    return get_command_line_option(nullptr, "--connect", argc, argv);
+  }
+
+  std::size_t get_queue_depth(int argc, char const * argv[])
+  {
+    int queue_depth = get_integral_command_line_option(nullptr, "--queue-depth", 16, argc, argv);
+    return queue_depth > 0 ? queue_depth : 0;
+  }
+
+  std::size_t get_cache_size(int argc, char const * argv[])
+  {
+    int megabytes = get_integral_command_line_option(nullptr, "--cache-size", 256, argc, argv);
+    return megabytes > 0 ? static_cast<std::size_t>(megabytes) << 20 : 0;
+  }
+
+  std::vector<std::string> get_extra_textures(int argc, char const * argv[])
+  {
+    std::vector<std::string> paths;
+    if (char const * option_value = get_command_line_option(nullptr, "--extra-textures", argc, argv)) {
+      std::istringstream list { option_value };
+      for (std::string path; std::getline(list, path, ','); )
+	if (!path.empty())
+	  paths.push_back(path);
+    }
+    return paths;
+  }
+
+  std::size_t get_max_pixels(int argc, char const * argv[])
+  {
+    int megapixels = get_integral_command_line_option(nullptr, "--max-megapixels", 256, argc, argv);
+    return megapixels > 0 ? static_cast<std::size_t>(megapixels) * 1000000 : 0;
+  }
+
+  // Built from the values a render uses rather than the options as
+  // written, so that requests spelling the same map differently share one
+  // cache entry.  The output path only counts through its format.
+  std::string get_request_key(int argc, char const * argv[])
+  {
+    std::ostringstream key;
+    key.precision(17);
+    char const * proj_name = get_projection_name(argc, argv);
+    key << get_texture_file_path(argc, argv)
+	<< '|' << (proj_name ? proj_name : "")
+	<< "|sla" << get_standard_latitude(argc, argv)
+	<< "|mla" << get_max_latitude(argc, argv)
+	<< "|cla" << get_center_latitude(argc, argv)
+	<< "|rot" << get_rotation(argc, argv)
+	<< "|w" << get_output_image_width(argc, argv)
+	<< "|h" << std::max(get_integral_command_line_option(nullptr, "--height", 0, argc, argv), 0)
+	<< "|slo" << get_standard_longitude(argc, argv)
+	<< (get_south_up(argc, argv) ? "|s" : "|n")
+	<< "|aa" << get_antialiasing(argc, argv)
+	<< (get_fast_math(argc, argv) ? "|fast" + std::to_string(get_fast_math_tolerance(argc, argv)) : "")
+	<< "|a" << get_approximation(argc, argv);
+    if (char const * window = get_command_line_option(nullptr, "--viewport", argc, argv))
+      key << "|v" << window;
+    if (char const * bbox = get_command_line_option(nullptr, "--bbox", argc, argv))
+      key << "|b" << bbox;
+    image_options options;
+    if (!get_image_options(options, argc, argv))
+      key << "|f?";
+    else if (options.format == image_format::jpeg)
+      key << "|jpeg" << options.jpeg_quality;
+    else if (options.format == image_format::png)
+      key << "|png" << options.png_level;
+    else
+      key << "|f" << static_cast<int>(options.format);
+    return key.str();
+  }
+
+  earth_texture load_texture(char const * path, texture_region const & region, profiler * prof, int argc, char const * argv[])
+  {
+    char const * texture_cache_directory = get_texture_cache_directory(argc, argv);
+    earth_texture texture;
+    {
+      profiler::scope phase { prof, "load texture" };
+      texture = texture_cache_directory
+	? earth_texture { path, texture_cache_directory }
+	: earth_texture { path, region };
+    }
+    if (!texture)
+      return texture;
+    if (get_mipmap(argc, argv)) {
+      profiler::scope phase { prof, "mipmaps" };
+      texture = texture.with_mipmaps(path, texture_cache_directory ? texture_cache_directory : "");
+    }
+    if (get_tiled_texture(argc, argv)) {
+      profiler::scope phase { prof, "tile texture" };
+      texture = texture.tiled();
+    }
+    return texture;
+  }
+
+  int render_map(earth_texture const & texture, std::size_t threads, profiler * prof, int argc, char const * argv[], std::FILE * output, std::size_t max_pixels)
+  {
+    char const * proj_name = get_projection_name(argc, argv);
+    std::unique_ptr<projection> proj = proj_name ? make_projection(proj_name, get_projection_parameters(argc, argv)) : nullptr;
+    if (!proj) {
+      std::cerr << "ERROR: unknown projection method." << std::endl;
+      return 1;
+    }
+
+    char const * tiles_directory = get_tiles_directory(argc, argv);
+    if (output && (tiles_directory || get_frame_count(argc, argv))) {
+      std::cerr << "ERROR: tiles and frames need an output path." << std::endl;
+      return 1;
+    }
+    if (tiles_directory) {
+      double standard_longitude = get_standard_longitude(argc, argv);
+      tile_pyramid pyramid { texture, *proj, tiles_directory, get_max_zoom(argc, argv), standard_longitude * std::numbers::pi / 180, get_south_up(argc, argv), threads };
+      pyramid.set_antialiasing(get_antialiasing(argc, argv));
+      profiler::scope phase { prof, "tiles" };
+      if (!pyramid.generate()) {
+	std::cerr << "ERROR: failed to write tiles." << std::endl;
+	return 1;
+      }
+      return 0;
+    }
+
+    viewport view;
+    if (!get_viewport(*proj, view, argc, argv)) {
+      std::cerr << "ERROR: invalid viewport." << std::endl;
+      return 1;
+    }
+    std::size_t width = get_output_image_width(argc, argv);
+    std::size_t height = get_output_image_height(view, width, argc, argv);
+    if (max_pixels && width && height > max_pixels / width) {
+      std::cerr << "ERROR: the image is larger than the server allows." << std::endl;
+      return 1;
+    }
+    double standard_longitude = get_standard_longitude(argc, argv);
+    bool south_up = get_south_up(argc, argv);
+    image_creator exact { texture, *proj, view, width, height, standard_longitude * std::numbers::pi / 180, south_up, threads };
+    std::unique_ptr<projection> fast = get_fast_math(argc, argv) ? make_fast_projection(exact, argc, argv) : nullptr;
+    image_creator creator { texture, fast ? *fast : *proj, view, width, height, standard_longitude * std::numbers::pi / 180, south_up, threads };
+    std::size_t antialiasing = get_antialiasing(argc, argv);
+    creator.set_antialiasing(antialiasing);
+    creator.set_approximation(get_approximation(argc, argv));
+    creator.set_profiler(prof);
+    image_options options;
+    if (!get_image_options(options, argc, argv)) {
+      std::cerr << "ERROR: unknown output format." << std::endl;
+      return 1;
+    }
+    creator.set_output_options(options);
+    creator.set_output_stream(output);
+
+    char const * output_path = get_output_path(argc, argv);
+    if (std::size_t frames = get_frame_count(argc, argv)) {
+      if (!creator.save_frames(output_path, frames, get_longitude_step(argc, argv) * std::numbers::pi / 180)) {
+	std::cerr << "ERROR: failed to write frames." << std::endl;
+	return 1;
+      }
+      return 0;
+    }
+
+    std::size_t strip_height = get_strip_height(argc, argv);
+    char const * remap_cache_directory = get_remap_cache_directory(argc, argv);
+    bool saved;
+    if (!remap_cache_directory || antialiasing > 1 || texture.level_count() > 1) {
+      saved = strip_height ? creator.stream_image(output_path, strip_height) : creator.save_image(output_path);
+    } else {
+      std::string remap_cache_path = get_remap_cache_path(remap_cache_directory, texture, argc, argv);
+      remap_table table;
+      {
+	profiler::scope phase { prof, "load remap table" };
+	table = remap_table::load(remap_cache_path, creator.image_width(), creator.image_height());
+      }
+      if (!table) {
+	table = creator.make_remap_table();
+	if (!table.save(remap_cache_path))
+	  std::cerr << "WARNING: failed to save a remap table." << std::endl;
+      }
+      saved = strip_height ? creator.stream_image(output_path, table, strip_height) : creator.save_image(output_path, table);
+    }
+    if (!saved) {
+      std::cerr << "ERROR: failed to write an image." << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  std::vector<std::vector<std::string>> read_jobs(std::istream & in)
+  {
+    std::vector<std::vector<std::string>> jobs;
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream tokens { line };
+      std::vector<std::string> job { "mkworldmap" };
+      for (std::string token; tokens >> token; )
+	job.push_back(token);
+      if (job.size() > 1 && job[1][0] != '#')
+	jobs.push_back(std::move(job));
+    }
+    return jobs;
+  }
+
+  int run_jobs(earth_texture const & texture, char const * jobs_path, std::size_t threads, std::size_t max_in_flight, profiler * prof)
+  {
+    std::vector<std::vector<std::string>> jobs;
+    if (std::strcmp(jobs_path, "-") == 0) {
+      jobs = read_jobs(std::cin);
+    } else {
+      std::ifstream in { jobs_path };
+      if (!in) {
+	std::cerr << "ERROR: failed to open a job file." << std::endl;
+	return 1;
+      }
+      jobs = read_jobs(in);
+    }
+
+    std::size_t threads_per_job = std::max<std::size_t>(1, threads / max_in_flight);
+    std::mutex output_mutex;
+    std::vector<int> statuses(jobs.size());
+    parallel_for(jobs.size(), max_in_flight, [&](std::size_t i) {
+      std::vector<char const *> job_argv;
+      for (std::string const & token : jobs[i])
+	job_argv.push_back(token.c_str());
+      int job_argc = job_argv.size();
+
+      auto start = std::chrono::steady_clock::now();
+      statuses[i] = render_map(texture, threads_per_job, prof, job_argc, job_argv.data());
+      auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+      char const * method = get_command_line_option("-p", "--projection", job_argc, job_argv.data());
+      std::lock_guard<std::mutex> lock { output_mutex };
+      std::cout << "job " << i + 1
+		<< '\t' << (statuses[i] == 0 ? "ok" : "failed")
+		<< '\t' << (method ? method : "-")
+		<< '\t' << get_output_path(job_argc, job_argv.data())
+		<< '\t' << elapsed.count() << " ms" << std::endl;
+    });
+
+    for (int status : statuses)
+      if (status != 0)
+	return 1;
+    return 0;
+  }
+
+  int run_server(earth_texture const & texture, char const * socket_path, std::size_t threads, int argc, char const * argv[])
+  {
+    server_options options;
+    options.workers = get_max_in_flight(argc, argv);
+    options.queue_depth = get_queue_depth(argc, argv);
+    options.cache_bytes = get_cache_size(argc, argv);
+    std::size_t threads_per_job = std::max<std::size_t>(1, threads / options.workers);
+    std::size_t max_pixels = get_max_pixels(argc, argv);
+
+    // Only the textures named on the server's command line are served.
+    // Those in --extra-textures are loaded by the first request naming
+    // them and kept for the life of the server; a load blocks only the
+    // requests for the same texture.
+    struct resident_texture
+    {
+      std::once_flag loaded;
+      std::unique_ptr<earth_texture const> texture;
+    };
+    std::string default_texture_path = get_texture_file_path(argc, argv);
+    std::map<std::string, resident_texture> textures;
+    for (std::string const & path : get_extra_textures(argc, argv))
+      textures.try_emplace(path);
+    auto texture_for = [&](char const * path) -> earth_texture const * {
+      if (path == default_texture_path)
+	return &texture;
+      auto found = textures.find(path);
+      if (found == textures.end()) {
+	std::cerr << "ERROR: the server does not serve this texture." << std::endl;
+	return nullptr;
+      }
+      resident_texture & resident = found->second;
+      std::call_once(resident.loaded, [&] {
+	earth_texture other = load_texture(path, texture_region { }, nullptr, argc, argv);
+	if (other)
+	  resident.texture = std::make_unique<earth_texture const>(std::move(other));
+      });
+      if (!resident.texture)
+	std::cerr << "ERROR: failed to load a texture." << std::endl;
+      return resident.texture.get();
+    };
+
+    // Requests may not name files for the server to write; the remap
+    // cache is the one from the server's own command line.
+    char const * remap_cache_directory = get_remap_cache_directory(argc, argv);
+    auto render = [&](render_server::arguments const & request, std::string & image) {
+      std::vector<char const *> request_argv;
+      for (std::string const & token : request) {
+	for (char const * option : { "--remap-cache", "--profile-json", "--tiles", "--frames", "--texture-cache" })
+	  if (token == option) {
+	    std::cerr << "ERROR: a request may not use " << option << '.' << std::endl;
+	    return false;
+	  }
+	request_argv.push_back(token.c_str());
+      }
+      if (get_integral_command_line_option(nullptr, "--antialias", 1, request_argv.size(), request_argv.data()) > static_cast<int>(image_creator::max_antialiasing)) {
+	std::cerr << "ERROR: a request may not use --antialias above " << image_creator::max_antialiasing << '.' << std::endl;
+	return false;
+      }
+      if (remap_cache_directory) {
+	request_argv.push_back("--remap-cache");
+	request_argv.push_back(remap_cache_directory);
+      }
+      int request_argc = request_argv.size();
+      earth_texture const * request_texture = texture_for(get_texture_file_path(request_argc, request_argv.data()));
+      if (!request_texture)
+	return false;
+
+      char * data = nullptr;
+      std::size_t size = 0;
+      std::FILE * stream = ::open_memstream(&data, &size);
+      if (!stream)
+	return false;
+      int status;
+      try {
+	status = render_map(*request_texture, threads_per_job, nullptr, request_argc, request_argv.data(), stream, max_pixels);
+      } catch (...) {
+	std::fclose(stream);
+	std::free(data);
+	throw;
+      }
+      std::fclose(stream);
+      if (status == 0)
+	image.assign(data, size);
+      std::free(data);
+      return status == 0;
+    };
+    auto key_of = [](render_server::arguments const & request) {
+      std::vector<char const *> request_argv;
+      for (std::string const & token : request)
+	request_argv.push_back(token.c_str());
+      return get_request_key(request_argv.size(), request_argv.data());
+    };
+
+    render_server server { render, key_of, options };
+    if (!server.serve(socket_path)) {
+      std::cerr << "ERROR: failed to listen on a socket." << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  int run_client(char const * socket_path, int argc, char const * argv[])
+  {
+    std::string request;
+    for (int i = 1; i < argc; ++i) {
+      if (std::strcmp(argv[i], "--connect") == 0) {
+	++i;
+	continue;
+      }
+      request += request.empty() ? "" : " ";
+      request += argv[i];
+    }
+
+    std::string image, error;
+    if (!request_render(socket_path, request, image, error)) {
+      std::cerr << "ERROR: " << error << '.' << std::endl;
+      return 1;
+    }
+    char const * output_path = get_output_path(argc, argv);
+    bool to_stdout = std::strcmp(output_path, "-") == 0;
+    std::FILE * out = to_stdout ? stdout : std::fopen(output_path, "wb");
+    bool written = out && std::fwrite(image.data(), 1, image.size(), out) == image.size();
+    if (out)
+      written = (to_stdout ? std::fflush(out) : std::fclose(out)) == 0 && written;
+    if (!written) {
+      std::cerr << "ERROR: failed to write an image." << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
 }
 
 int main(int argc, char const * argv[])
 {
   using namespace mkworldmap;
-  earth_texture texture { get_texture_file_path(argc, argv) };
+  char const * profile_json_path = get_profile_json_path(argc, argv);
+  std::unique_ptr<profiler> prof = get_profile(argc, argv) || profile_json_path ? std::make_unique<profiler>() : nullptr;
+
+  if (char const * connect_path = get_connect_path(argc, argv))
+    return run_client(connect_path, argc, argv);
+
+  earth_texture texture = load_texture(get_texture_file_path(argc, argv), get_texture_region(argc, argv), prof.get(), argc, argv);
   if (!texture) {
     std::cerr << "ERROR: failed to load a texture." << std::endl;
     return 1;
   }
-  
-  projection_method proj_method = get_projection_method(argc, argv);
-  if (proj_method == projection_method::invalid) {
-    std::cerr << "ERROR: unknown projection method." << std::endl;
-    return 1;
-  }
-  std::unique_ptr<projection> proj { };
-  switch (proj_method) {
-  case projection_method::cylindrical_equal_area: {
-    double standard_latitude = get_standard_latitude(argc, argv);
-    proj = std::make_unique<cylindrical_equal_area_projection>(standard_latitude * std::numbers::pi / 180);
-  } break;
-  case projection_method::mercator: {
-    double max_latitude = get_max_latitude(argc, argv);
-    proj = std::make_unique<mercator_projection>(max_latitude * std::numbers::pi / 180);
-  } break;
-  case projection_method::central_cylindrical: {
-    double max_latitude = get_max_latitude(argc, argv);
-    proj = std::make_unique<central_cylindrical_projection>(max_latitude * std::numbers::pi / 180);
-  } break;
-  default:
-    proj = make_singleton_projection(proj_method);
+
+  std::size_t threads = get_thread_count(argc, argv);
+  char const * jobs_path = get_jobs_path(argc, argv);
+  char const * serve_path = get_serve_path(argc, argv);
+  int status = serve_path
+    ? run_server(texture, serve_path, threads, argc, argv)
+    : jobs_path
+    ? run_jobs(texture, jobs_path, threads, get_max_in_flight(argc, argv), prof.get())
+    : render_map(texture, threads, prof.get(), argc, argv);
+
+  if (get_profile(argc, argv))
+    prof->write_text(std::cerr);
+  if (profile_json_path) {
+    std::ofstream out { profile_json_path };
+    prof->write_json(out);
+    if (!out) {
+      std::cerr << "ERROR: failed to write a profile." << std::endl;
+      return 1;
+    }
   }
-  
-  std::size_t width = get_output_image_width(argc, argv);
-  double standard_longitude = get_standard_longitude(argc, argv);
-  bool south_up = get_south_up(argc, argv);
-  image_creator creator { texture, *proj, width, standard_longitude * std::numbers::pi / 180, south_up };
-
-  char const * output_path = get_output_path(argc, argv);
-  creator.save_image(output_path);
-  return 0;
+  return status;
 }
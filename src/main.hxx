@@ -1,6 +1,12 @@
 #ifndef MKWORLDMAP_MAIN_HXX_2024_03_18_KPCAMY4ZS8UA
 #define MKWORLDMAP_MAIN_HXX_2024_03_18_KPCAMY4ZS8UA
 
+#include <cstdio>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
 namespace mkworldmap
 {
 
@@ -10,14 +16,67 @@ namespace mkworldmap
   bool get_boolean_command_line_option(char const * short_option, char const * long_option, bool default_value, int argc, char const * argv[]);
   
   char const * get_texture_file_path(int argc, char const * argv[]);
-  projection_method get_projection_method(int argc, char const * argv[]);
+  char const * get_texture_cache_directory(int argc, char const * argv[]);
+  bool get_tiled_texture(int argc, char const * argv[]);
+  bool get_mipmap(int argc, char const * argv[]);
+  bool get_scaled_texture(int argc, char const * argv[]);
+  bool get_cropped_texture(int argc, char const * argv[]);
+  char const * get_projection_name(int argc, char const * argv[]);
   std::size_t get_output_image_width(int argc, char const * argv[]);
   double get_standard_longitude(int argc, char const * argv[]);
   char const * get_output_path(int argc, char const * argv[]);
+  int get_jpeg_quality(int argc, char const * argv[]);
+  int get_png_level(int argc, char const * argv[]);
+  bool get_image_options(image_options & options, int argc, char const * argv[]);
   bool get_south_up(int argc, char const * argv[]);
+  std::size_t get_thread_count(int argc, char const * argv[]);
+  std::size_t get_strip_height(int argc, char const * argv[]);
+  std::size_t get_antialiasing(int argc, char const * argv[]);
   
   double get_standard_latitude(int argc, char const * argv[]);
   double get_max_latitude(int argc, char const * argv[]);
+  double get_center_latitude(int argc, char const * argv[]);
+  double get_rotation(int argc, char const * argv[]);
+  projection_parameters get_projection_parameters(int argc, char const * argv[]);
+
+  bool get_fast_math(int argc, char const * argv[]);
+  std::size_t get_fast_math_tolerance(int argc, char const * argv[]);
+  double get_approximation(int argc, char const * argv[]);
+  std::unique_ptr<projection> make_fast_projection(image_creator const & exact, int argc, char const * argv[]);
+
+  char const * get_remap_cache_directory(int argc, char const * argv[]);
+  std::string get_remap_cache_path(char const * directory, earth_texture const & texture, int argc, char const * argv[]);
+
+  bool get_viewport(projection const & proj, viewport & view, int argc, char const * argv[]);
+  std::size_t get_output_image_height(viewport const & view, std::size_t width, int argc, char const * argv[]);
+  texture_region get_texture_region(int argc, char const * argv[]);
+
+  std::size_t get_frame_count(int argc, char const * argv[]);
+  double get_longitude_step(int argc, char const * argv[]);
+
+  char const * get_tiles_directory(int argc, char const * argv[]);
+  std::size_t get_max_zoom(int argc, char const * argv[]);
+
+  bool get_profile(int argc, char const * argv[]);
+  char const * get_profile_json_path(int argc, char const * argv[]);
+
+  char const * get_jobs_path(int argc, char const * argv[]);
+  std::size_t get_max_in_flight(int argc, char const * argv[]);
+
+  char const * get_serve_path(int argc, char const * argv[]);
+  char const * get_connect_path(int argc, char const * argv[]);
+  std::size_t get_queue_depth(int argc, char const * argv[]);
+  std::size_t get_cache_size(int argc, char const * argv[]);
+  std::vector<std::string> get_extra_textures(int argc, char const * argv[]);
+  std::size_t get_max_pixels(int argc, char const * argv[]);
+  std::string get_request_key(int argc, char const * argv[]);
+
+  earth_texture load_texture(char const * path, texture_region const & region, profiler * prof, int argc, char const * argv[]);
+  int render_map(earth_texture const & texture, std::size_t threads, profiler * prof, int argc, char const * argv[], std::FILE * output = nullptr, std::size_t max_pixels = 0);
+  std::vector<std::vector<std::string>> read_jobs(std::istream & in);
+  int run_jobs(earth_texture const & texture, char const * jobs_path, std::size_t threads, std::size_t max_in_flight, profiler * prof);
+  int run_server(earth_texture const & texture, char const * socket_path, std::size_t threads, int argc, char const * argv[]);
+  int run_client(char const * socket_path, int argc, char const * argv[]);
 
 }
 
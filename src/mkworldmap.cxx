@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "image_creator.hxx"
+#include "mkworldmap.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    std::size_t bytes_per_pixel(pixel_format format)
+    {
+      return format == pixel_format::rgb || format == pixel_format::bgr ? 3 : 4;
+    }
+
+    // The window whose corner pixel centers are those of the w by h pixels
+    // at (x, y) in a width by height map over view.  The creator mirrors
+    // south-up images itself, so the window is taken from the other side.
+    viewport part_viewport(viewport view, std::size_t width, std::size_t height, bool south_up, std::size_t x, std::size_t y, std::size_t w, std::size_t h)
+    {
+      double x_step = view.width() / (width - 1);
+      double y_step = view.height() / (height - 1);
+      std::size_t column = south_up ? width - x - w : x;
+      std::size_t row = south_up ? y : height - y - h;
+      return viewport {
+	view.x_min + column * x_step,
+	view.x_min + (column + w - 1) * x_step,
+	view.y_min + row * y_step,
+	view.y_min + (row + h - 1) * y_step
+      };
+    }
+
+    void convert_rows(char unsigned const * rgb, pixel_buffer const & buffer)
+    {
+      std::size_t n = bytes_per_pixel(buffer.format);
+      bool swap = buffer.format == pixel_format::bgr || buffer.format == pixel_format::bgra;
+      for (std::size_t i = 0; i < buffer.height; ++i) {
+	char unsigned const * source = rgb + i * buffer.width * 3;
+	char unsigned * destination = buffer.data + i * buffer.stride;
+	for (std::size_t j = 0; j < buffer.width; ++j, source += 3, destination += n) {
+	  destination[0] = source[swap ? 2 : 0];
+	  destination[1] = source[1];
+	  destination[2] = source[swap ? 0 : 2];
+	  if (n == 4)
+	    destination[3] = 0xff;
+	}
+      }
+    }
+  }
+
+  bool render_into(earth_texture const & texture, map_request const & request, pixel_buffer const & buffer)
+  {
+    std::unique_ptr<projection> proj = make_projection(request.projection, request.parameters);
+    if (!proj || !texture || !buffer.data)
+      return false;
+    viewport view = request.view ? *request.view : proj->bounds();
+    if (!(view.width() > 0) || !(view.height() > 0))
+      return false;
+    std::size_t width = request.width;
+    std::size_t height = request.height ? request.height : static_cast<std::size_t>(width * view.height() / view.width());
+    if (width < 2 || height < 2 || buffer.width < 2 || buffer.height < 2
+	|| buffer.width > width || request.x > width - buffer.width
+	|| buffer.height > height || request.y > height - buffer.height
+	|| buffer.stride < buffer.width * bytes_per_pixel(buffer.format))
+      return false;
+
+    bool whole = buffer.width == width && buffer.height == height;
+    viewport part = whole ? view : part_viewport(view, width, height, request.south_up, request.x, request.y, buffer.width, buffer.height);
+    image_creator creator { texture, *proj, part, buffer.width, buffer.height, request.standard_longitude, request.south_up, std::max<std::size_t>(request.threads, 1) };
+    creator.set_antialiasing(std::max<std::size_t>(request.antialiasing, 1));
+    if (buffer.format == pixel_format::rgb && buffer.stride == buffer.width * 3) {
+      creator.render(buffer.data);
+      return true;
+    }
+    std::vector<char unsigned> rgb(buffer.width * buffer.height * 3);
+    creator.render(rgb.data());
+    convert_rows(rgb.data(), buffer);
+    return true;
+  }
+
+}
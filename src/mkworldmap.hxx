@@ -0,0 +1,61 @@
+#ifndef MKWORLDMAP_MKWORLDMAP_HXX_2026_10_17_R7VJ2MQ9XH4C
+#define MKWORLDMAP_MKWORLDMAP_HXX_2026_10_17_R7VJ2MQ9XH4C
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+#include "earth_texture.hxx"
+#include "projection.hxx"
+
+namespace mkworldmap
+{
+  // Entry point of libmkworldmap for rendering into memory.  A texture
+  // that is loaded once, and given mipmaps or tiled before use, can be
+  // shared by any number of concurrent render_into calls, because they
+  // only read it.
+
+  enum class pixel_format
+  {
+    rgb,
+    bgr,
+    rgba,
+    bgra
+  };
+
+  // A caller-owned image whose rows are stride bytes apart.  Alpha is
+  // always opaque.
+  struct pixel_buffer
+  {
+    char unsigned * data = nullptr;
+    std::size_t width = 0;
+    std::size_t height = 0;
+    std::size_t stride = 0;
+    pixel_format format = pixel_format::rgb;
+  };
+
+  // A map of width by height pixels over view (the whole projection by
+  // default; height 0 follows its aspect ratio).  The buffer receives
+  // the pixels whose top-left corner is at (x, y), so a map can be
+  // rendered in pieces that match the whole.  Angles are in radians.
+  struct map_request
+  {
+    std::string_view projection;
+    projection_parameters parameters { };
+    std::optional<viewport> view;
+    std::size_t width = 0;
+    std::size_t height = 0;
+    double standard_longitude = 0;
+    bool south_up = false;
+    std::size_t x = 0;
+    std::size_t y = 0;
+    std::size_t antialiasing = 1;
+    std::size_t threads = 1;
+  };
+
+  // Returns false for an unknown projection, a map or buffer smaller than
+  // 2 by 2 pixels, or a buffer that does not fit in the map.
+  bool render_into(earth_texture const &, map_request const &, pixel_buffer const &);
+}
+
+#endif
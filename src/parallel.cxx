@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    struct work_range
+    {
+      std::mutex mutex;
+      std::size_t begin;
+      std::size_t end;
+    };
+
+    bool pop_front(work_range & range, std::size_t & index)
+    {
+      std::lock_guard<std::mutex> lock { range.mutex };
+      if (range.begin == range.end)
+	return false;
+      index = range.begin++;
+      return true;
+    }
+
+    bool steal_back(work_range & victim, work_range & thief)
+    {
+      std::scoped_lock lock { victim.mutex, thief.mutex };
+      std::size_t remaining = victim.end - victim.begin;
+      if (remaining == 0)
+	return false;
+      std::size_t stolen = (remaining + 1) / 2;
+      thief.begin = victim.end - stolen;
+      thief.end = victim.end;
+      victim.end = thief.begin;
+      return true;
+    }
+
+    // Threads started by every parallel_for still running, which nested
+    // calls, such as a JPEG encoder inside a strip or the renders of
+    // concurrent jobs, share.
+    std::atomic<std::size_t> running_threads = 0;
+
+    // Takes up to wanted threads, fewer when others already run more than
+    // limit between them, and gives them back on destruction.
+    class thread_reservation
+    {
+      std::size_t count;
+
+    public:
+      thread_reservation(std::size_t wanted, std::size_t limit)
+      {
+	std::size_t running = running_threads.load();
+	do
+	  count = running < limit ? std::min(wanted, limit - running) : 0;
+	while (!running_threads.compare_exchange_weak(running, running + count));
+      }
+
+      thread_reservation(thread_reservation const &) = delete;
+      thread_reservation & operator=(thread_reservation const &) = delete;
+
+      ~thread_reservation()
+      {
+	running_threads -= count;
+      }
+
+      std::size_t size() const
+      {
+	return count;
+      }
+    };
+
+    bool steal(std::vector<work_range> & ranges, std::size_t thief)
+    {
+      for (std::size_t i = 1; i < ranges.size(); ++i) {
+	std::size_t victim = (thief + i) % ranges.size();
+	if (steal_back(ranges[victim], ranges[thief]))
+	  return true;
+      }
+      return false;
+    }
+  }
+
+  std::size_t default_thread_count()
+  {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  void parallel_for(std::size_t count, std::size_t threads, std::function<void(std::size_t)> const & task)
+  {
+    parallel_for(count, threads, [&task](std::size_t index, std::size_t) {
+      task(index);
+    });
+  }
+
+  // The caller works too, so at most threads - 1 more are started, and
+  // nested calls get only what the enclosing ones leave of the larger of
+  // threads and the hardware's.  The first exception a task throws stops
+  // the remaining tasks and is rethrown here once every worker is done.
+  void parallel_for(std::size_t count, std::size_t threads, std::function<void(std::size_t, std::size_t)> const & task)
+  {
+    threads = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(count, 1));
+    thread_reservation reserved { threads - 1, std::max(threads, default_thread_count()) - 1 };
+    threads = reserved.size() + 1;
+    if (threads == 1) {
+      for (std::size_t i = 0; i < count; ++i)
+	task(i, 0);
+      return;
+    }
+
+    std::vector<work_range> ranges(threads);
+    for (std::size_t t = 0; t < threads; ++t) {
+      ranges[t].begin = count * t / threads;
+      ranges[t].end = count * (t + 1) / threads;
+    }
+
+    std::mutex failure_mutex;
+    std::exception_ptr failure;
+    std::atomic<bool> failed = false;
+    auto worker = [&](std::size_t t) {
+      try {
+	std::size_t index;
+	do {
+	  while (!failed && pop_front(ranges[t], index))
+	    task(index, t);
+	} while (!failed && steal(ranges, t));
+      } catch (...) {
+	std::lock_guard<std::mutex> lock { failure_mutex };
+	if (!failure)
+	  failure = std::current_exception();
+	failed = true;
+      }
+    };
+
+    {
+      std::vector<std::jthread> workers;
+      workers.reserve(threads - 1);
+      for (std::size_t t = 1; t < threads; ++t)
+	workers.emplace_back(worker, t);
+      worker(0);
+    }
+    if (failure)
+      std::rethrow_exception(failure);
+  }
+
+}
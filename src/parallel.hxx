@@ -0,0 +1,20 @@
+#ifndef MKWORLDMAP_PARALLEL_HXX_2026_10_17_W8SQ4KNE2TJB
+#define MKWORLDMAP_PARALLEL_HXX_2026_10_17_W8SQ4KNE2TJB
+
+#include <cstddef>
+#include <functional>
+
+namespace mkworldmap
+{
+
+  std::size_t default_thread_count();
+
+  void parallel_for(std::size_t count, std::size_t threads, std::function<void(std::size_t)> const & task);
+
+  // Same as above, but also passes the index of the worker running the task,
+  // which is below min(threads, count).
+  void parallel_for(std::size_t count, std::size_t threads, std::function<void(std::size_t, std::size_t)> const & task);
+
+}
+
+#endif
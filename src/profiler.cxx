@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <ctime>
+
+#include <sys/resource.h>
+
+#include "profiler.hxx"
+
+namespace mkworldmap
+{
+  double process_cpu_seconds()
+  {
+    timespec t;
+    ::clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+  }
+
+  std::size_t peak_rss_kilobytes()
+  {
+    rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+  }
+
+  profiler::scope::scope(profiler * owner, char const * name)
+    : owner { owner },
+      name { name }
+  {
+    if (!owner)
+      return;
+    wall_start = std::chrono::steady_clock::now();
+    cpu_start = process_cpu_seconds();
+  }
+
+  profiler::scope::~scope()
+  {
+    if (!owner)
+      return;
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+    owner->add_phase(name, wall.count(), process_cpu_seconds() - cpu_start);
+  }
+
+  profiler::profiler()
+    : start { std::chrono::steady_clock::now() }
+  {
+  }
+
+  void profiler::add_phase(char const * name, double wall_seconds, double cpu_seconds)
+  {
+    std::lock_guard<std::mutex> lock { mutex };
+    auto it = std::find_if(phases.begin(), phases.end(), [name](phase_record const & p) { return p.name == name; });
+    if (it == phases.end())
+      it = phases.insert(phases.end(), phase_record { name, 0, 0, 0 });
+    ++it->calls;
+    it->wall_seconds += wall_seconds;
+    it->cpu_seconds += cpu_seconds;
+  }
+
+  void profiler::add_worker(std::size_t worker, std::size_t tasks, double busy_seconds)
+  {
+    std::lock_guard<std::mutex> lock { mutex };
+    if (workers.size() <= worker)
+      workers.resize(worker + 1, worker_record { 0, 0 });
+    workers[worker].tasks += tasks;
+    workers[worker].busy_seconds += busy_seconds;
+  }
+
+  void profiler::add_pixels(std::size_t count, std::size_t background_count)
+  {
+    std::lock_guard<std::mutex> lock { mutex };
+    pixels += count;
+    background_pixels += background_count;
+  }
+
+  void profiler::write_text(std::ostream & out) const
+  {
+    std::lock_guard<std::mutex> lock { mutex };
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    out << "profile: elapsed " << elapsed.count() << " s, peak RSS " << peak_rss_kilobytes() << " KiB\n";
+    for (phase_record const & p : phases)
+      out << "profile: phase " << p.name << '\t' << p.calls << " calls\t" << p.wall_seconds << " s wall\t" << p.cpu_seconds << " s cpu\n";
+    out << "profile: pixels " << pixels << ", background " << background_pixels
+	<< ", " << (elapsed.count() > 0 ? pixels / elapsed.count() : 0) << " pixels/s\n";
+    for (std::size_t w = 0; w < workers.size(); ++w)
+      out << "profile: worker " << w << '\t' << workers[w].tasks << " tasks\t" << workers[w].busy_seconds << " s busy\n";
+    out.flush();
+  }
+
+  void profiler::write_json(std::ostream & out) const
+  {
+    std::lock_guard<std::mutex> lock { mutex };
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    out << "{\n"
+	<< "  \"elapsed_seconds\": " << elapsed.count() << ",\n"
+	<< "  \"peak_rss_kilobytes\": " << peak_rss_kilobytes() << ",\n"
+	<< "  \"pixels\": " << pixels << ",\n"
+	<< "  \"background_pixels\": " << background_pixels << ",\n"
+	<< "  \"pixels_per_second\": " << (elapsed.count() > 0 ? pixels / elapsed.count() : 0) << ",\n"
+	<< "  \"phases\": [";
+    for (std::size_t i = 0; i < phases.size(); ++i)
+      out << (i ? ",\n" : "\n")
+	  << "    { \"name\": \"" << phases[i].name << "\", \"calls\": " << phases[i].calls
+	  << ", \"wall_seconds\": " << phases[i].wall_seconds << ", \"cpu_seconds\": " << phases[i].cpu_seconds << " }";
+    out << "\n  ],\n"
+	<< "  \"workers\": [";
+    for (std::size_t w = 0; w < workers.size(); ++w)
+      out << (w ? ",\n" : "\n")
+	  << "    { \"tasks\": " << workers[w].tasks << ", \"busy_seconds\": " << workers[w].busy_seconds << " }";
+    out << "\n  ]\n"
+	<< "}\n";
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef MKWORLDMAP_PROFILER_HXX_2026_10_17_R5NB8XQ2HJ4C
+#define MKWORLDMAP_PROFILER_HXX_2026_10_17_R5NB8XQ2HJ4C
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace mkworldmap
+{
+  // Collects wall and CPU time per named phase, pixel counts and how much
+  // work each worker thread did.  All members are safe to call from several
+  // threads.  Code that can be profiled takes a profiler pointer and does
+  // nothing when it is null.
+  class profiler
+  {
+    struct phase_record
+    {
+      std::string name;
+      std::size_t calls;
+      double wall_seconds;
+      double cpu_seconds;
+    };
+
+    struct worker_record
+    {
+      std::size_t tasks;
+      double busy_seconds;
+    };
+
+    mutable std::mutex mutex;
+    std::chrono::steady_clock::time_point start;
+    std::vector<phase_record> phases;
+    std::vector<worker_record> workers;
+    std::size_t pixels = 0;
+    std::size_t background_pixels = 0;
+
+  public:
+
+    class scope
+    {
+      profiler * owner;
+      char const * name;
+      std::chrono::steady_clock::time_point wall_start;
+      double cpu_start;
+
+    public:
+      scope() = delete;
+      scope(scope const &) = delete;
+      scope(scope &&) = delete;
+      scope & operator=(scope const &) = delete;
+      scope & operator=(scope &&) = delete;
+      scope(profiler *, char const *);
+      ~scope();
+    };
+
+    profiler();
+    profiler(profiler const &) = delete;
+    profiler(profiler &&) = delete;
+    profiler & operator=(profiler const &) = delete;
+    profiler & operator=(profiler &&) = delete;
+
+    void add_phase(char const *, double, double);
+    void add_worker(std::size_t, std::size_t, double);
+    void add_pixels(std::size_t, std::size_t);
+
+    void write_text(std::ostream &) const;
+    void write_json(std::ostream &) const;
+  };
+
+  double process_cpu_seconds();
+  std::size_t peak_rss_kilobytes();
+}
+
+#endif
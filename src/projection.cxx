@@ -1,13 +1,30 @@
 
 #include <cmath>
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <numbers>
+#include <optional>
+#include <string_view>
+#include <utility>
 
+#include "fast_math.hxx"
 #include "projection.hxx"
 #include "util.hxx"
 
 namespace mkworldmap
 {
 
+  double viewport::width() const
+  {
+    return x_max - x_min;
+  }
+
+  double viewport::height() const
+  {
+    return y_max - y_min;
+  }
+
   projection::projection(double x_min_, double x_max_, double y_min_, double y_max_)
     : x_min { x_min_ },
       x_max { x_max_ },
@@ -26,458 +43,1613 @@ namespace mkworldmap
     return y_max - y_min;
   }
 
-  singleton_projection::singleton_projection(double x_min, double x_max, double y_min, double y_max, point (*inverter)(double, double))
-    : inverter { inverter },
-      projection { x_min, x_max, y_min, y_max }
+  viewport projection::bounds() const
   {
+    return viewport { x_min, x_max, y_min, y_max };
   }
 
-  point singleton_projection::invert(double x, double y) const
+  void projection::invert_many(std::span<double const> xs, double y, std::span<point> out) const
   {
-    return inverter(x, y);
+    for (std::size_t i = 0; i < xs.size(); ++i)
+      out[i] = invert(xs[i], y);
   }
-  
-  std::unique_ptr<projection> make_singleton_projection(projection_method method)
+
+  point projection::forward(double, double) const
   {
-    using enum projection_method;
-    switch (method) {
-    case equirectangular:
-      return std::make_unique<singleton_projection>
-	(equirectangular_x_min,
-	 equirectangular_x_max,
-	 equirectangular_y_min,
-	 equirectangular_y_max,
-	 equirectangular_invert);
-    case miller:
-      return std::make_unique<singleton_projection>
-	(miller_x_min,
-	 miller_x_max,
-	 miller_y_min,
-	 miller_y_max,
-	 miller_invert);
-    case sinusoidal:
-      return std::make_unique<singleton_projection>
-	(sinusoidal_x_min,
-	 sinusoidal_x_max,
-	 sinusoidal_y_min,
-	 sinusoidal_y_max,
-	 sinusoidal_invert);
-    case mollweide:
-      return std::make_unique<singleton_projection>
-	(mollweide_x_min,
-	 mollweide_x_max,
-	 mollweide_y_min,
-	 mollweide_y_max,
-	 mollweide_invert);
-    case azimuthal_equidistant:
-      return std::make_unique<singleton_projection>
-	(azimuthal_equidistant_x_min,
-	 azimuthal_equidistant_x_max,
-	 azimuthal_equidistant_y_min,
-	 azimuthal_equidistant_y_max,
-	 azimuthal_equidistant_invert);
-    case aitoff:
-      return std::make_unique<singleton_projection>
-	(aitoff_x_min,
-	 aitoff_x_max,
-	 aitoff_y_min,
-	 aitoff_y_max,
-	 aitoff_invert);
-    case orthographic:
-      return std::make_unique<singleton_projection>
-	(orthographic_x_min,
-	 orthographic_x_max,
-	 orthographic_y_min,
-	 orthographic_y_max,
-	 orthographic_invert);
-    case orthographic_aitoff:
-      return std::make_unique<singleton_projection>
-	(orthographic_aitoff_x_min,
-	 orthographic_aitoff_x_max,
-	 orthographic_aitoff_y_min,
-	 orthographic_aitoff_y_max,
-	 orthographic_aitoff_invert);
-    case lambert_azimuthal_equal_area:
-      return std::make_unique<singleton_projection>
-	(lambert_azimuthal_equal_area_x_min,
-	 lambert_azimuthal_equal_area_x_max,
-	 lambert_azimuthal_equal_area_y_min,
-	 lambert_azimuthal_equal_area_y_max,
-	 lambert_azimuthal_equal_area_invert);
-    case hammer:
-      return std::make_unique<singleton_projection>
-	(hammer_x_min,
-	 hammer_x_max,
-	 hammer_y_min,
-	 hammer_y_max,
-	 hammer_invert);
-    case gall_stereographic:
-      return std::make_unique<singleton_projection>
-	(gall_stereographic_x_min,
-	 gall_stereographic_x_max,
-	 gall_stereographic_y_min,
-	 gall_stereographic_y_max,
-	 gall_stereographic_invert);
-    case eckert_1:
-      return std::make_unique<singleton_projection>
-	(eckert_1_x_min,
-	 eckert_1_x_max,
-	 eckert_1_y_min,
-	 eckert_1_y_max,
-	 eckert_1_invert);
-    case eckert_2:
-      return std::make_unique<singleton_projection>
-	(eckert_2_x_min,
-	 eckert_2_x_max,
-	 eckert_2_y_min,
-	 eckert_2_y_max,
-	 eckert_2_invert);
-    case eckert_3:
-      return std::make_unique<singleton_projection>
-	(eckert_3_x_min,
-	 eckert_3_x_max,
-	 eckert_3_y_min,
-	 eckert_3_y_max,
-	 eckert_3_invert);
-    case eckert_4:
-      return std::make_unique<singleton_projection>
-	(eckert_4_x_min,
-	 eckert_4_x_max,
-	 eckert_4_y_min,
-	 eckert_4_y_max,
-	 eckert_4_invert);
-    case eckert_5:
-      return std::make_unique<singleton_projection>
-	(eckert_5_x_min,
-	 eckert_5_x_max,
-	 eckert_5_y_min,
-	 eckert_5_y_max,
-	 eckert_5_invert);
-    case eckert_6:
-      return std::make_unique<singleton_projection>
-	(eckert_6_x_min,
-	 eckert_6_x_max,
-	 eckert_6_y_min,
-	 eckert_6_y_max,
-	 eckert_6_invert);
-    case collignon:
-      return std::make_unique<singleton_projection>
-	(collignon_x_min,
-	 collignon_x_max,
-	 collignon_y_min,
-	 collignon_y_max,
-	 collignon_invert);
-    }
-    return std::unique_ptr<projection> { };
+    return point { std::nan(""), std::nan("") };
   }
 
-  point cylindrical_projection_invert(double x, double y, double (*shrink_factor)(double), double (*invert_height)(double))
+  inverse_statistics projection::invert_statistics(std::span<double const> xs, double y, std::span<point> out) const
   {
-    double factor = shrink_factor(y);
-    double lon = x / factor;
-    if (lon < -std::numbers::pi || lon > std::numbers::pi)
-      return point { std::nan(""), std::nan("") };
-    else
-      return point {
-	lon,
-	invert_height(y)
-      };
+    invert_many(xs, y, out);
+    return inverse_statistics { };
   }
-  
-  point equirectangular_invert(double x, double y)
+
+  bool projection::separable() const
   {
-    return point { x, y };
+    return false;
   }
 
-  cylindrical_equal_area_projection::cylindrical_equal_area_projection()
-    : cylindrical_equal_area_projection { 0 }
+  bool projection::fast_math() const
   {
+    return false;
   }
 
-  cylindrical_equal_area_projection::cylindrical_equal_area_projection(double sl)
-    : s_factor { std::cos(sl) },
-      projection {
-	-std::cos(sl) * std::numbers::pi,
-	std::cos(sl) * std::numbers::pi,
-	-1 / std::cos(sl),
-	1 / std::cos(sl)
-      }
+  std::pair<double, double> projection::x_domain(double) const
   {
+    return { -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity() };
   }
 
-  point cylindrical_equal_area_projection::invert(double x, double y) const
+  namespace
   {
-    return point {
-      x / s_factor,
-      std::asin(y * s_factor)
+    // A projection is a policy type: a registered name, whether it is
+    // separable, its bounds, and row(y), which does the per-row work once
+    // and returns the per-pixel inverse as a callable.  invert and
+    // invert_many of policy_projection are both built from row(y), so the
+    // two always agree and the inverse inlines into each pixel loop.
+    // Policies whose valid x for a row is an interval may provide
+    // x_domain(y), which lets the renderer skip the pixels outside it.
+    // Policies whose per-pixel work is transcendental may also provide
+    // fast_row(y), which does that work in float with fast_math.  Domain
+    // tests stay in double there so that coverage does not change.
+    // Policies may provide forward(lon, lat), and those whose inverse is
+    // iterative provide invert_statistics(xs, y, out) as well.
+    // Policies whose inverse goes through a point on the unit sphere may
+    // provide unit_row(y), which returns that point, so that an oblique
+    // aspect turns it directly instead of going back from a longitude and
+    // latitude.  With fast_math, an oblique aspect also turns the globe in
+    // float, whether or not the policy has fast_row.
+
+    point const outside { std::nan(""), std::nan("") };
+
+    std::pair<double, double> constexpr whole_row {
+      -std::numeric_limits<double>::infinity(),
+      std::numeric_limits<double>::infinity()
     };
-  }
+    std::pair<double, double> constexpr empty_row {
+      std::numeric_limits<double>::infinity(),
+      -std::numeric_limits<double>::infinity()
+    };
+
+    // |x| <= radius, or nothing when the row misses the disc altogether.
+    std::pair<double, double> disc_row(double radius_squared, double y)
+    {
+      double r = radius_squared - y * y;
+      if (!(r >= 0))
+	return empty_row;
+      return { -std::sqrt(r), std::sqrt(r) };
+    }
+
+    // Pseudocylindrical projections, where the longitude is x divided by a
+    // factor of y.  Policy supplies shrink_factor and invert_height.
+    template <typename Policy>
+    struct cylindrical
+    {
+      static constexpr bool separable = false;
 
-  mercator_projection::mercator_projection(double max_latitude_)
-    : max_latitude { max_latitude_ },
-      projection {
-	-std::numbers::pi,
-	std::numbers::pi,
-	-inverse_gudermann(max_latitude_),
-	inverse_gudermann(max_latitude_)
+      auto row(double y) const
+      {
+	return [factor = Policy::shrink_factor(y), lat = Policy::invert_height(y)](double x) {
+	  double lon = x / factor;
+	  if (lon < -std::numbers::pi || lon > std::numbers::pi)
+	    return outside;
+	  return point { lon, lat };
+	};
       }
-  {
-  }
 
-  point mercator_projection::invert(double x, double y) const
-  {
-    return point {
-      x,
-      gudermann(y)
+      std::pair<double, double> x_domain(double y) const
+      {
+	double factor = Policy::shrink_factor(y);
+	if (std::isnan(factor) || factor == 0)
+	  return empty_row;
+	if (factor < 0)
+	  return whole_row;
+	return { -std::numbers::pi * factor, std::numbers::pi * factor };
+      }
     };
-  }
 
-  point miller_invert(double x, double y)
-  {
-    return point {
-      x,
-      1.25 * gudermann(0.8 * y)
+    // Solves f(t) = target for t in [lo, hi], where f returns an increasing
+    // function's value and derivative, by Newton's method kept inside a
+    // bracket that shrinks to bisection when a step leaves it.  Returns NaN
+    // when target is out of the function's range.
+    template <typename F>
+    double solve_increasing(F const & f, double target, double lo, double hi, std::size_t * iterations = nullptr)
+    {
+      std::size_t constexpr max_steps = 60;
+      double constexpr tolerance = 1e-13;
+      auto [f_lo, slope_lo] = f(lo);
+      auto [f_hi, slope_hi] = f(hi);
+      if (iterations)
+	*iterations += 2;
+      double margin = 1e-12 * std::max(1.0, f_hi - f_lo);
+      if (!(target >= f_lo - margin && target <= f_hi + margin))
+	return std::nan("");
+      if (target <= f_lo)
+	return lo;
+      if (target >= f_hi)
+	return hi;
+      double t = lo + (hi - lo) * (target - f_lo) / (f_hi - f_lo);
+      for (std::size_t step = 0; step < max_steps; ++step) {
+	auto [value, slope] = f(t);
+	if (iterations)
+	  ++*iterations;
+	double next = t - (value - target) / slope;
+	if (std::abs(next - t) < tolerance)
+	  return std::clamp(next, lo, hi);
+	if (value < target)
+	  lo = t;
+	else
+	  hi = t;
+	if (!(next > lo && next < hi))
+	  next = (lo + hi) / 2;
+	if (hi - lo < tolerance)
+	  return next;
+	t = next;
+      }
+      return t;
+    }
+
+    // Pseudocylindrical projections given by their forward formula,
+    // x = lon * length(lat) and y = height(lat), where height is odd and
+    // increasing, and length is even.  Each row's latitude is found once
+    // by solve_increasing.  Policy supplies length(lat) and height(lat),
+    // which returns the height and its derivative.
+    template <typename Policy>
+    struct pseudocylindrical : cylindrical<Policy>
+    {
+      static double latitude(double y, std::size_t * iterations = nullptr)
+      {
+	double lat = solve_increasing(Policy::height, std::abs(y), 0, std::numbers::pi * 0.5, iterations);
+	return y < 0 ? -lat : lat;
+      }
+
+      static double shrink_factor(double y)
+      {
+	return Policy::length(latitude(y));
+      }
+
+      static double invert_height(double y)
+      {
+	return latitude(y);
+      }
+
+      point forward(double lon, double lat) const
+      {
+	return point { lon * Policy::length(lat), Policy::height(lat).first };
+      }
+
+      inverse_statistics invert_statistics(std::span<double const> xs, double y, std::span<point> out) const
+      {
+	inverse_statistics statistics { .solves = 1 };
+	double lat = latitude(y, &statistics.iterations);
+	statistics.max_iterations = statistics.iterations;
+	double factor = Policy::length(lat);
+	for (std::size_t i = 0; i < xs.size(); ++i) {
+	  double lon = xs[i] / factor;
+	  out[i] = std::isnan(lat) || lon < -std::numbers::pi || lon > std::numbers::pi ? outside : point { lon, lat };
+	}
+	return statistics;
+      }
     };
-  }
 
-  central_cylindrical_projection::central_cylindrical_projection(double max_latitude_)
-    : max_latitude { max_latitude_ },
-      projection {
-	-std::numbers::pi,
-	std::numbers::pi,
-	-std::tan(max_latitude_),
-	std::tan(max_latitude_)
+    // A forward point with its partial derivatives.
+    struct forward_derivatives
+    {
+      point p;
+      double dx_dlon;
+      double dx_dlat;
+      double dy_dlon;
+      double dy_dlat;
+    };
+
+    // Inverts one row of a projection that only has a forward formula by
+    // Newton's method.  Each pixel starts from the solutions of the two
+    // before it, extrapolated linearly, so a pixel inside the map usually
+    // takes one or two steps; the first pixel of a run starts from the
+    // policy's initial guess.  Pixels that do not converge, or converge
+    // off the map, are outside.
+    template <typename Policy>
+    class newton_row
+    {
+      Policy const & policy;
+      double y;
+      inverse_statistics * statistics;
+      point previous[2];
+      double previous_x[2];
+      std::size_t warm = 0;
+
+      static std::size_t constexpr max_steps = 32;
+      // Quadratic convergence leaves an error of about the square of the
+      // last step, far below a texel.
+      static double constexpr tolerance = 1e-6;
+      static double constexpr pole_start = std::numbers::pi * 0.5 * 0.999;
+
+    public:
+      newton_row(Policy const & policy, double y, inverse_statistics * statistics = nullptr)
+	: policy { policy },
+	  y { y },
+	  statistics { statistics }
+      {
       }
-  {
-  }
 
-  point central_cylindrical_projection::invert(double x, double y) const
-  {
-    return point {
-      x,
-      std::atan(y)
+      point operator()(double x)
+      {
+	if constexpr (requires { policy.beyond_poles(x, y); }) {
+	  if (policy.beyond_poles(x, y)) {
+	    warm = 0;
+	    return outside;
+	  }
+	}
+	point guess;
+	if (warm == 2 && previous_x[1] != previous_x[0]) {
+	  double t = (x - previous_x[1]) / (previous_x[1] - previous_x[0]);
+	  guess = point {
+	    previous[1].x + t * (previous[1].x - previous[0].x),
+	    previous[1].y + t * (previous[1].y - previous[0].y)
+	  };
+	} else if (warm > 0) {
+	  guess = previous[1];
+	} else {
+	  guess = policy.initial_guess(x, y);
+	}
+	// Newton's method cannot leave a pole, where dx/dlon vanishes.
+	double lon = guess.x;
+	double lat = std::clamp(guess.y, -pole_start, pole_start);
+	double last_lon = lon;
+	double last_lat = lat;
+	double last_residual = std::numeric_limits<double>::infinity();
+	bool converged = false;
+	std::size_t steps = 0;
+	while (steps < max_steps) {
+	  forward_derivatives f = policy.forward_jacobian(lon, lat);
+	  ++steps;
+	  double ex = f.p.x - x;
+	  double ey = f.p.y - y;
+	  double residual = std::max(std::abs(ex), std::abs(ey));
+	  if (!(residual < last_residual)) {
+	    // The last step overshot; try half of it.
+	    lon = (lon + last_lon) / 2;
+	    lat = (lat + last_lat) / 2;
+	    continue;
+	  }
+	  double determinant = f.dx_dlon * f.dy_dlat - f.dx_dlat * f.dy_dlon;
+	  if (!(std::abs(determinant) > 0))
+	    break;
+	  double dlon = (ex * f.dy_dlat - ey * f.dx_dlat) / determinant;
+	  double dlat = (ey * f.dx_dlon - ex * f.dy_dlon) / determinant;
+	  if (std::abs(dlon) < tolerance && std::abs(dlat) < tolerance) {
+	    lon -= dlon;
+	    lat = std::clamp(lat - dlat, -std::numbers::pi * 0.5, std::numbers::pi * 0.5);
+	    converged = true;
+	    break;
+	  }
+	  // Stop halfway to a pole rather than on it, where the Jacobian of
+	  // some projections is singular, but keep the whole longitude step.
+	  double room = std::numbers::pi * 0.5 - std::abs(lat);
+	  if (std::abs(lat - dlat) > std::numbers::pi * 0.5)
+	    dlat = std::copysign(0.5 * room, dlat);
+	  last_lon = lon;
+	  last_lat = lat;
+	  last_residual = residual;
+	  lon = std::clamp(lon - dlon, -2 * std::numbers::pi, 2 * std::numbers::pi);
+	  lat -= dlat;
+	}
+	if (statistics) {
+	  ++statistics->solves;
+	  statistics->iterations += steps;
+	  statistics->max_iterations = std::max(statistics->max_iterations, steps);
+	  statistics->failures += !converged;
+	}
+	if (!converged || lon < -std::numbers::pi - 1e-9 || lon > std::numbers::pi + 1e-9) {
+	  warm = 0;
+	  return outside;
+	}
+	previous[0] = previous[1];
+	previous_x[0] = previous_x[1];
+	previous[1] = point { lon, lat };
+	previous_x[1] = x;
+	warm = std::min<std::size_t>(warm + 1, 2);
+	return previous[1];
+      }
     };
-  }
 
-  double sinusoidal_shrink_factor(double y)
-  {
-    return std::cos(y);
-  }
+    // Projections with only a forward formula.  Policy supplies
+    // forward_jacobian(lon, lat) and initial_guess(x, y), and may supply
+    // beyond_poles(x, y) to skip points outside the map inside its
+    // x_domain.
+    template <typename Policy>
+    struct iterative
+    {
+      static constexpr bool separable = false;
 
-  double sinusoidal_invert_height(double y)
-  {
-    return y;
-  }
-  
-  point sinusoidal_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, sinusoidal_shrink_factor, sinusoidal_invert_height);
-  }
+      auto row(double y) const
+      {
+	return newton_row<Policy> { static_cast<Policy const &>(*this), y };
+      }
 
-  double mollweide_shrink_factor(double y)
-  {
-    double s = mollweide_parameter * std::numbers::pi * y / 4;
-    return mollweide_parameter * std::sqrt(1 - s * s);
-  }
+      point forward(double lon, double lat) const
+      {
+	return static_cast<Policy const &>(*this).forward_jacobian(lon, lat).p;
+      }
 
-  double mollweide_invert_height(double y)
-  {
-    double theta = std::asin(y * mollweide_parameter * std::numbers::pi / 4);
-    return std::asin((2 * theta + std::sin(2 * theta)) / std::numbers::pi);
-  }
-  
-  point mollweide_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, mollweide_shrink_factor, mollweide_invert_height);
-  }
+      inverse_statistics invert_statistics(std::span<double const> xs, double y, std::span<point> out) const
+      {
+	inverse_statistics statistics;
+	newton_row<Policy> inverse { static_cast<Policy const &>(*this), y, &statistics };
+	for (std::size_t i = 0; i < xs.size(); ++i)
+	  out[i] = inverse(xs[i]);
+	return statistics;
+      }
+    };
 
-  point azeq_invert(double x, double y, double range)
-  {
-    double r = std::sqrt(x * x + y * y);
-    if (r > range)
-      return point { std::nan(""), std::nan("") };
-    double theta = std::atan2(y, x);
-    double ny = std::cos(theta + std::numbers::pi * 0.5);
-    double nz = std::sin(theta + std::numbers::pi * 0.5);
-    double x3 = std::cos(r);
-    double y3 = nz * std::sin(r);
-    double z3 = -ny * std::sin(r);
-    return spacial_point_to_point(x3, y3, z3);
-  }
+    // A point on the unit sphere, with x towards (0, 0) and z towards the
+    // north pole.  NaN is outside the map.
+    struct unit_vector
+    {
+      double x;
+      double y;
+      double z;
+    };
 
-  point azimuthal_equidistant_invert(double x, double y)
-  {
-    return azeq_invert(x, y, std::numbers::pi);
-  }
+    unit_vector const outside_vector { std::nan(""), std::nan(""), std::nan("") };
 
-  point aitoff_invert(double x, double y)
-  {
-    point p = azeq_invert(x * 0.5, y, std::numbers::pi * 0.5);
-    p.x *= 2;
-    return p;
-  }
+    // Turns the sphere of the map's own coordinates onto the globe: the
+    // map's (0, 0) goes to center_latitude on the prime meridian, after a
+    // turn of rotation about it.
+    class sphere_rotation
+    {
+      double m[3][3];
 
-  point orthographic_invert(double x, double y)
-  {
-    if (x * x + y * y > 1)
-      return point { std::nan(""), std::nan("") };
-    return point {
-      std::asin(x / std::sqrt(1 - y * y)),
-      std::asin(y)
+    public:
+      sphere_rotation() = delete;
+      sphere_rotation(sphere_rotation const &) = default;
+      sphere_rotation(sphere_rotation &&) = default;
+      sphere_rotation & operator=(sphere_rotation const &) = default;
+      sphere_rotation & operator=(sphere_rotation &&) = default;
+
+      // A turn about the x axis by -rotation, then about the y axis by
+      // -center_latitude.
+      sphere_rotation(double center_latitude, double rotation)
+      {
+	double sin_phi = std::sin(center_latitude);
+	double cos_phi = std::cos(center_latitude);
+	double sin_gamma = std::sin(-rotation);
+	double cos_gamma = std::cos(-rotation);
+	double rows[3][3] = {
+	  { cos_phi, -sin_phi * sin_gamma, -sin_phi * cos_gamma },
+	  { 0, cos_gamma, -sin_gamma },
+	  { sin_phi, cos_phi * sin_gamma, cos_phi * cos_gamma }
+	};
+	std::copy(&rows[0][0], &rows[0][0] + 9, &m[0][0]);
+      }
+
+      // The globe's longitude and latitude of v.  Fast uses fast_math, as
+      // fast_row does.  Both are forced inline: called from the pixel loop,
+      // the float path is no faster than libm.
+      template <bool Fast>
+      [[gnu::always_inline]] point to_globe(unit_vector v) const
+      {
+	if (std::isnan(v.x))
+	  return outside;
+	double x = m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z;
+	double y = m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z;
+	double z = m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z;
+	if constexpr (Fast)
+	  return point { fast_math::atan2(y, x), fast_math::atan2(z, std::sqrt(x * x + y * y)) };
+	else
+	  return spacial_point_to_point(x, y, z);
+      }
+
+      template <bool Fast>
+      [[gnu::always_inline]] point to_globe(point p) const
+      {
+	if (std::isnan(p.x))
+	  return outside;
+	if constexpr (Fast) {
+	  float lon = std::abs(static_cast<float>(p.x));
+	  float lat = static_cast<float>(p.y);
+	  float cos_lat = fast_math::cos(std::abs(lat));
+	  float sin_lon = fast_math::sin(lon);
+	  return to_globe<true>(unit_vector { cos_lat * fast_math::cos(lon), p.x < 0 ? -cos_lat * sin_lon : cos_lat * sin_lon, fast_math::sin_half_range(lat) });
+	} else {
+	  double cos_lat = std::cos(p.y);
+	  return to_globe<false>(unit_vector { cos_lat * std::cos(p.x), cos_lat * std::sin(p.x), std::sin(p.y) });
+	}
+      }
+
+      // From the globe back to the map's own coordinates.
+      point from_globe(double lon, double lat) const
+      {
+	double cos_lat = std::cos(lat);
+	unit_vector v { cos_lat * std::cos(lon), cos_lat * std::sin(lon), std::sin(lat) };
+	return spacial_point_to_point(
+	  m[0][0] * v.x + m[1][0] * v.y + m[2][0] * v.z,
+	  m[0][1] * v.x + m[1][1] * v.y + m[2][1] * v.z,
+	  m[0][2] * v.x + m[1][2] * v.y + m[2][2] * v.z);
+      }
     };
-  }
 
-  point orthographic_aitoff_invert(double x, double y)
-  {
-    point p = orthographic_invert(x * 0.5, y);
-    p.x *= 2;
-    return p;
-  }
+    std::optional<sphere_rotation> oblique_aspect(projection_parameters const & parameters)
+    {
+      if (parameters.center_latitude == 0 && parameters.rotation == 0)
+	return std::nullopt;
+      return sphere_rotation { parameters.center_latitude, parameters.rotation };
+    }
 
-  point laea_invert(double x, double y, double range)
-  {
-    double r = std::sqrt(x * x + y * y);
-    double nr = 2 * std::asin(r / 2.0);
-    if (nr > range)
-      return point { std::nan(""), std::nan("") };
-    double theta = std::atan2(y, x);
-    double ny = std::cos(theta + std::numbers::pi * 0.5);
-    double nz = std::sin(theta + std::numbers::pi * 0.5);
-    double x3 = std::cos(nr);
-    double y3 = nz * std::sin(nr);
-    double z3 = -ny * std::sin(nr);
-    return spacial_point_to_point(x3, y3, z3);
-  }
+    // The point at angular distance nr from the centre in the direction
+    // of (x, y), which is r from it on the plane.
+    unit_vector spherical_unit_vector(double x, double y, double r, double nr)
+    {
+      if (r == 0)
+	return unit_vector { 1, 0, 0 };
+      double s = std::sin(nr) / r;
+      return unit_vector { std::cos(nr), x * s, y * s };
+    }
 
-  point lambert_azimuthal_equal_area_invert(double x, double y)
-  {
-    return laea_invert(x, y, std::numbers::pi);
-  }
+    unit_vector azeq_unit_vector(double x, double y, double range)
+    {
+      double r = std::sqrt(x * x + y * y);
+      if (r > range)
+	return outside_vector;
+      return spherical_unit_vector(x, y, r, r);
+    }
 
-  point hammer_invert(double x, double y)
-  {
-    point p = laea_invert(x * 0.5, y, std::numbers::pi * 0.5);
-    p.x *= 2;
-    return p;
-  }
+    unit_vector laea_unit_vector(double x, double y, double range)
+    {
+      double r = std::sqrt(x * x + y * y);
+      double nr = 2 * std::asin(r / 2.0);
+      if (!(nr <= range))
+	return outside_vector;
+      return spherical_unit_vector(x, y, r, nr);
+    }
 
-  point gall_stereographic_invert(double x, double y)
-  {
-    return point {
-      x,
-      2 * std::atan(y / (std::sqrt(2) + 1))
+    point azeq_invert(double x, double y, double range)
+    {
+      double r = std::sqrt(x * x + y * y);
+      if (r > range)
+	return outside;
+      double theta = std::atan2(y, x);
+      double ny = std::cos(theta + std::numbers::pi * 0.5);
+      double nz = std::sin(theta + std::numbers::pi * 0.5);
+      double x3 = std::cos(r);
+      double y3 = nz * std::sin(r);
+      double z3 = -ny * std::sin(r);
+      return spacial_point_to_point(x3, y3, z3);
+    }
+
+    point laea_invert(double x, double y, double range)
+    {
+      double r = std::sqrt(x * x + y * y);
+      double nr = 2 * std::asin(r / 2.0);
+      if (nr > range)
+	return outside;
+      double theta = std::atan2(y, x);
+      double ny = std::cos(theta + std::numbers::pi * 0.5);
+      double nz = std::sin(theta + std::numbers::pi * 0.5);
+      double x3 = std::cos(nr);
+      double y3 = nz * std::sin(nr);
+      double z3 = -ny * std::sin(nr);
+      return spacial_point_to_point(x3, y3, z3);
+    }
+
+    // The same as azeq_invert and laea_invert once the angular distance nr
+    // from the centre is known, using sin(theta) = y / r and
+    // cos(theta) = x / r instead of atan2 followed by sin and cos.
+    point fast_spherical_invert(float x, float y, float r, float nr)
+    {
+      if (r == 0)
+	return point { 0, 0 };
+      float s = fast_math::sin(nr);
+      float x3 = fast_math::cos(nr);
+      float y3 = x / r * s;
+      float z3 = y / r * s;
+      return point {
+	fast_math::atan2(y3, x3),
+	fast_math::atan2(z3, std::sqrt(x3 * x3 + y3 * y3))
+      };
+    }
+
+    point fast_azeq_invert(double x, double y, double range)
+    {
+      double r = std::sqrt(x * x + y * y);
+      if (r > range)
+	return outside;
+      return fast_spherical_invert(x, y, r, r);
+    }
+
+    point fast_laea_invert(double x, double y, double r_max)
+    {
+      double r = std::sqrt(x * x + y * y);
+      if (r > r_max)
+	return outside;
+      return fast_spherical_invert(x, y, r, 2 * fast_math::asin(static_cast<float>(r) / 2));
+    }
+
+    point orthographic_invert(double x, double y)
+    {
+      if (x * x + y * y > 1)
+	return outside;
+      return point {
+	std::asin(x / std::sqrt(1 - y * y)),
+	std::asin(y)
+      };
+    }
+
+    struct equirectangular
+    {
+      static constexpr std::string_view name = "equirectangular";
+      static constexpr bool separable = true;
+
+      equirectangular(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::numbers::pi * 0.5, std::numbers::pi * 0.5 };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) { return point { x, y }; };
+      }
     };
-  }
 
-  double eckert_1_shrink_factor(double y)
-  {
-    return 1 - std::abs(y) / std::numbers::pi;
-  }
+    struct cylindrical_equal_area
+    {
+      static constexpr std::string_view name = "cylindrical-equal-area";
+      static constexpr bool separable = true;
 
-  double eckert_1_invert_height(double y)
-  {
-    return y;
-  }
-  
-  point eckert_1_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_1_shrink_factor, eckert_1_invert_height);
-  }
+      double s_factor;
 
-  double eckert_2_shrink_factor(double y)
-  {
-    double s = 2 - std::abs(y);
-    return s / std::numbers::pi;
-  }
+      cylindrical_equal_area(projection_parameters const & parameters)
+	: s_factor { std::cos(parameters.standard_latitude) }
+      {
+      }
 
-  double eckert_2_invert_height(double y)
-  {
-    double s = 2 - std::abs(y);
-    double sign = y >= 0 ? 1 : -1;
-    return sign * std::asin((4 - s * s) / 3);
-  }
-  
-  point eckert_2_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_2_shrink_factor, eckert_2_invert_height);
-  }
+      viewport bounds() const
+      {
+	return { -s_factor * std::numbers::pi, s_factor * std::numbers::pi, -1 / s_factor, 1 / s_factor };
+      }
 
-  double eckert_3_shrink_factor(double y)
-  {
-    return 1 + std::sqrt(1 - y * y / (std::numbers::pi * std::numbers::pi));
-  }
+      auto row(double y) const
+      {
+	return [s_factor = s_factor, lat = std::asin(y * s_factor)](double x) { return point { x / s_factor, lat }; };
+      }
+    };
 
-  double eckert_3_invert_height(double y)
-  {
-    return y / 2;
-  }
-  
-  point eckert_3_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_3_shrink_factor, eckert_3_invert_height);
-  }
+    struct mercator
+    {
+      static constexpr std::string_view name = "mercator";
+      static constexpr bool separable = true;
 
-  double eckert_4_shrink_factor(double y)
-  {
-    double s = y / std::numbers::pi;
-    return 1 + std::sqrt(1 - s * s);
-  }
+      double max_latitude;
 
-  double eckert_4_invert_height(double y)
-  {
-    double theta = std::asin(y / std::numbers::pi);
-    return std::asin((theta + std::sin(theta) * std::cos(theta) + 2 * std::sin(theta)) / (2 + std::numbers::pi / 2));
-  }
+      mercator(projection_parameters const & parameters)
+	: max_latitude { parameters.max_latitude }
+      {
+      }
 
-  point eckert_4_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_4_shrink_factor, eckert_4_invert_height);
-  }
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -inverse_gudermann(max_latitude), inverse_gudermann(max_latitude) };
+      }
 
-  double eckert_5_shrink_factor(double y)
-  {
-    return 1 + std::cos(y / 2);
-  }
+      auto row(double y) const
+      {
+	return [lat = gudermann(y)](double x) { return point { x, lat }; };
+      }
+    };
 
-  double eckert_5_invert_height(double y)
-  {
-    return y / 2;
-  }
-  
-  point eckert_5_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_5_shrink_factor, eckert_5_invert_height);
-  }
+    struct miller
+    {
+      static constexpr std::string_view name = "miller";
+      static constexpr bool separable = true;
 
-  double eckert_6_shrink_factor(double y)
-  {
-    return 1 + std::cos(y / 2);
-  }
+      miller(projection_parameters const &) { }
 
-  double eckert_6_invert_height(double y)
-  {
-    return std::asin((y / 2 + std::sin(y / 2)) / (1  + std::numbers::pi / 2));
-  }
-  
-  point eckert_6_invert(double x, double y)
-  {
-    return cylindrical_projection_invert(x, y, eckert_6_shrink_factor, eckert_6_invert_height);
+      viewport bounds() const
+      {
+	double y_max = 1.25 * inverse_gudermann(0.4 * std::numbers::pi);
+	return { -std::numbers::pi, std::numbers::pi, -y_max, y_max };
+      }
+
+      auto row(double y) const
+      {
+	return [lat = 1.25 * gudermann(0.8 * y)](double x) { return point { x, lat }; };
+      }
+    };
+
+    struct central_cylindrical
+    {
+      static constexpr std::string_view name = "central-cylindrical";
+      static constexpr bool separable = true;
+
+      double max_latitude;
+
+      central_cylindrical(projection_parameters const & parameters)
+	: max_latitude { parameters.max_latitude }
+      {
+      }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::tan(max_latitude), std::tan(max_latitude) };
+      }
+
+      auto row(double y) const
+      {
+	return [lat = std::atan(y)](double x) { return point { x, lat }; };
+      }
+    };
+
+    struct sinusoidal : cylindrical<sinusoidal>
+    {
+      static constexpr std::string_view name = "sinusoidal";
+
+      sinusoidal(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::numbers::pi * 0.5, std::numbers::pi * 0.5 };
+      }
+
+      static double shrink_factor(double y)
+      {
+	return std::cos(y);
+      }
+
+      static double invert_height(double y)
+      {
+	return y;
+      }
+    };
+
+    struct mollweide : cylindrical<mollweide>
+    {
+      static constexpr std::string_view name = "mollweide";
+      static constexpr double parameter = 2 * std::sqrt(2) / std::numbers::pi;
+
+      mollweide(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi * parameter, std::numbers::pi * parameter, -4 / (parameter * std::numbers::pi), 4 / (parameter * std::numbers::pi) };
+      }
+
+      static double shrink_factor(double y)
+      {
+	double s = parameter * std::numbers::pi * y / 4;
+	return parameter * std::sqrt(1 - s * s);
+      }
+
+      static double invert_height(double y)
+      {
+	double theta = std::asin(y * parameter * std::numbers::pi / 4);
+	return std::asin((2 * theta + std::sin(2 * theta)) / std::numbers::pi);
+      }
+    };
+
+    struct azimuthal_equidistant
+    {
+      static constexpr std::string_view name = "azimuthal-equidistant";
+      static constexpr bool separable = false;
+
+      azimuthal_equidistant(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::numbers::pi, std::numbers::pi };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) { return azeq_invert(x, y, std::numbers::pi); };
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y](double x) { return fast_azeq_invert(x, y, std::numbers::pi); };
+      }
+
+      auto unit_row(double y) const
+      {
+	return [y](double x) { return azeq_unit_vector(x, y, std::numbers::pi); };
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	return disc_row(std::numbers::pi * std::numbers::pi, y);
+      }
+    };
+
+    struct aitoff
+    {
+      static constexpr std::string_view name = "aitoff";
+      static constexpr bool separable = false;
+
+      aitoff(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::numbers::pi * 0.5, std::numbers::pi * 0.5 };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) {
+	  point p = azeq_invert(x * 0.5, y, std::numbers::pi * 0.5);
+	  p.x *= 2;
+	  return p;
+	};
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y](double x) {
+	  point p = fast_azeq_invert(x * 0.5, y, std::numbers::pi * 0.5);
+	  p.x *= 2;
+	  return p;
+	};
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	auto [x_lo, x_hi] = disc_row(std::numbers::pi * std::numbers::pi / 4, y);
+	return { 2 * x_lo, 2 * x_hi };
+      }
+    };
+
+    struct orthographic
+    {
+      static constexpr std::string_view name = "orthographic";
+      static constexpr bool separable = false;
+
+      orthographic(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -1, 1, -1, 1 };
+      }
+
+      auto row(double y) const
+      {
+	return [y, radius = std::sqrt(1 - y * y), lat = std::asin(y)](double x) {
+	  if (x * x + y * y > 1)
+	    return outside;
+	  return point { std::asin(x / radius), lat };
+	};
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y, radius = static_cast<float>(std::sqrt(1 - y * y)), lat = std::asin(y)](double x) {
+	  if (x * x + y * y > 1)
+	    return outside;
+	  return point { fast_math::asin(static_cast<float>(x) / radius), lat };
+	};
+      }
+
+      auto unit_row(double y) const
+      {
+	return [y](double x) {
+	  double depth = 1 - x * x - y * y;
+	  if (depth < 0)
+	    return outside_vector;
+	  return unit_vector { std::sqrt(depth), x, y };
+	};
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	return disc_row(1, y);
+      }
+    };
+
+    struct orthographic_aitoff
+    {
+      static constexpr std::string_view name = "orthographic-aitoff";
+      static constexpr bool separable = false;
+
+      orthographic_aitoff(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2, 2, -1, 1 };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) {
+	  point p = orthographic_invert(x * 0.5, y);
+	  p.x *= 2;
+	  return p;
+	};
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y, radius = static_cast<float>(std::sqrt(1 - y * y)), lat = std::asin(y)](double x) {
+	  x *= 0.5;
+	  if (x * x + y * y > 1)
+	    return outside;
+	  return point { 2 * fast_math::asin(static_cast<float>(x) / radius), lat };
+	};
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	auto [x_lo, x_hi] = disc_row(1, y);
+	return { 2 * x_lo, 2 * x_hi };
+      }
+    };
+
+    struct lambert_azimuthal_equal_area
+    {
+      static constexpr std::string_view name = "lambert-azimuthal-equal-area";
+      static constexpr bool separable = false;
+
+      lambert_azimuthal_equal_area(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2, 2, -2, 2 };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) { return laea_invert(x, y, std::numbers::pi); };
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y](double x) { return fast_laea_invert(x, y, 2); };
+      }
+
+      auto unit_row(double y) const
+      {
+	return [y](double x) { return laea_unit_vector(x, y, std::numbers::pi); };
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	return disc_row(4, y);
+      }
+    };
+
+    struct hammer
+    {
+      static constexpr std::string_view name = "hammer";
+      static constexpr bool separable = false;
+
+      hammer(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2 * std::sqrt(2), 2 * std::sqrt(2), -std::sqrt(2), std::sqrt(2) };
+      }
+
+      auto row(double y) const
+      {
+	return [y](double x) {
+	  point p = laea_invert(x * 0.5, y, std::numbers::pi * 0.5);
+	  p.x *= 2;
+	  return p;
+	};
+      }
+
+      auto fast_row(double y) const
+      {
+	return [y](double x) {
+	  point p = fast_laea_invert(x * 0.5, y, std::sqrt(2));
+	  p.x *= 2;
+	  return p;
+	};
+      }
+
+      std::pair<double, double> x_domain(double y) const
+      {
+	auto [x_lo, x_hi] = disc_row(2, y);
+	return { 2 * x_lo, 2 * x_hi };
+      }
+    };
+
+    struct gall_stereographic
+    {
+      static constexpr std::string_view name = "gall-stereographic";
+      static constexpr bool separable = true;
+
+      gall_stereographic(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::sqrt(2) - 1, std::sqrt(2) + 1 };
+      }
+
+      auto row(double y) const
+      {
+	return [lat = 2 * std::atan(y / (std::sqrt(2) + 1))](double x) { return point { x, lat }; };
+      }
+    };
+
+    struct eckert_1 : cylindrical<eckert_1>
+    {
+      static constexpr std::string_view name = "eckert-1";
+
+      eckert_1(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -std::numbers::pi, std::numbers::pi, -std::numbers::pi * 0.5, std::numbers::pi * 0.5 };
+      }
+
+      static double shrink_factor(double y)
+      {
+	return 1 - std::abs(y) / std::numbers::pi;
+      }
+
+      static double invert_height(double y)
+      {
+	return y;
+      }
+    };
+
+    struct eckert_2 : cylindrical<eckert_2>
+    {
+      static constexpr std::string_view name = "eckert-2";
+
+      eckert_2(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2, 2, -1, 1 };
+      }
+
+      static double shrink_factor(double y)
+      {
+	double s = 2 - std::abs(y);
+	return s / std::numbers::pi;
+      }
+
+      static double invert_height(double y)
+      {
+	double s = 2 - std::abs(y);
+	double sign = y >= 0 ? 1 : -1;
+	return sign * std::asin((4 - s * s) / 3);
+      }
+    };
+
+    struct eckert_3 : cylindrical<eckert_3>
+    {
+      static constexpr std::string_view name = "eckert-3";
+
+      eckert_3(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2 * std::numbers::pi, 2 * std::numbers::pi, -std::numbers::pi, std::numbers::pi };
+      }
+
+      static double shrink_factor(double y)
+      {
+	return 1 + std::sqrt(1 - y * y / (std::numbers::pi * std::numbers::pi));
+      }
+
+      static double invert_height(double y)
+      {
+	return y / 2;
+      }
+    };
+
+    struct eckert_4 : cylindrical<eckert_4>
+    {
+      static constexpr std::string_view name = "eckert-4";
+
+      eckert_4(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2 * std::numbers::pi, 2 * std::numbers::pi, -std::numbers::pi, std::numbers::pi };
+      }
+
+      static double shrink_factor(double y)
+      {
+	double s = y / std::numbers::pi;
+	return 1 + std::sqrt(1 - s * s);
+      }
+
+      static double invert_height(double y)
+      {
+	double theta = std::asin(y / std::numbers::pi);
+	return std::asin((theta + std::sin(theta) * std::cos(theta) + 2 * std::sin(theta)) / (2 + std::numbers::pi / 2));
+      }
+    };
+
+    struct eckert_5 : cylindrical<eckert_5>
+    {
+      static constexpr std::string_view name = "eckert-5";
+
+      eckert_5(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2 * std::numbers::pi, 2 * std::numbers::pi, -std::numbers::pi, std::numbers::pi };
+      }
+
+      static double shrink_factor(double y)
+      {
+	return 1 + std::cos(y / 2);
+      }
+
+      static double invert_height(double y)
+      {
+	return y / 2;
+      }
+    };
+
+    struct eckert_6 : cylindrical<eckert_6>
+    {
+      static constexpr std::string_view name = "eckert-6";
+
+      eckert_6(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -2 * std::numbers::pi, 2 * std::numbers::pi, -std::numbers::pi, std::numbers::pi };
+      }
+
+      static double shrink_factor(double y)
+      {
+	return 1 + std::cos(y / 2);
+      }
+
+      static double invert_height(double y)
+      {
+	return std::asin((y / 2 + std::sin(y / 2)) / (1  + std::numbers::pi / 2));
+      }
+    };
+
+    struct collignon : cylindrical<collignon>
+    {
+      static constexpr std::string_view name = "collignon";
+
+      collignon(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return {
+	  -2 * std::sqrt(std::numbers::pi) * std::sqrt(2),
+	  2 * std::sqrt(std::numbers::pi) * std::sqrt(2),
+	  std::sqrt(std::numbers::pi) * (1 - std::sqrt(2)),
+	  std::sqrt(std::numbers::pi)
+	};
+      }
+
+      static double shrink_factor(double y)
+      {
+	double s = 1 - y / std::sqrt(std::numbers::pi);
+	return 2 * s / std::sqrt(std::numbers::pi);
+      }
+
+      static double invert_height(double y)
+      {
+	double s = 1 - y / std::sqrt(std::numbers::pi);
+	return std::asin(1 - s * s);
+      }
+    };
+
+    // Robinson's table of parallel lengths and distances from the equator
+    // every 5 degrees, interpolated by cubic Hermite splines with central
+    // difference slopes.
+    struct robinson : pseudocylindrical<robinson>
+    {
+      static constexpr std::string_view name = "robinson";
+      static constexpr std::array<double, 19> lengths {
+	1.0000, 0.9986, 0.9954, 0.9900, 0.9822, 0.9730, 0.9600, 0.9427, 0.9216, 0.8962,
+	0.8679, 0.8350, 0.7986, 0.7597, 0.7186, 0.6732, 0.6213, 0.5722, 0.5322
+      };
+      static constexpr std::array<double, 19> heights {
+	0.0000, 0.0620, 0.1240, 0.1860, 0.2480, 0.3100, 0.3720, 0.4340, 0.4958, 0.5571,
+	0.6176, 0.6769, 0.7346, 0.7903, 0.8435, 0.8936, 0.9394, 0.9761, 1.0000
+      };
+      static constexpr double x_scale = 0.8487;
+      static constexpr double y_scale = 1.3523;
+      static constexpr double step = 5 * std::numbers::pi / 180;
+
+      robinson(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -x_scale * std::numbers::pi, x_scale * std::numbers::pi, -y_scale, y_scale };
+      }
+
+      // The interpolated value and its derivative at |lat|.  Lengths are
+      // even and heights odd, which gives the slopes at the equator.
+      static std::pair<double, double> interpolate(std::array<double, 19> const & table, bool odd, double lat)
+      {
+	double u = std::min(std::abs(lat) / step, 18.0);
+	std::size_t i = std::min<std::size_t>(u, 17);
+	double t = u - i;
+	auto at = [&](std::ptrdiff_t k) {
+	  if (k < 0)
+	    return odd ? -table[-k] : table[-k];
+	  return table[std::min<std::ptrdiff_t>(k, 18)];
+	};
+	double m0 = (at(i + 1) - at(static_cast<std::ptrdiff_t>(i) - 1)) / 2;
+	double m1 = i + 1 == 18 ? at(18) - at(17) : (at(i + 2) - at(i)) / 2;
+	double v0 = at(i);
+	double v1 = at(i + 1);
+	double t2 = t * t;
+	double t3 = t2 * t;
+	double value = (2 * t3 - 3 * t2 + 1) * v0 + (t3 - 2 * t2 + t) * m0 + (-2 * t3 + 3 * t2) * v1 + (t3 - t2) * m1;
+	double slope = (6 * t2 - 6 * t) * v0 + (3 * t2 - 4 * t + 1) * m0 + (-6 * t2 + 6 * t) * v1 + (3 * t2 - 2 * t) * m1;
+	return { value, slope / step };
+      }
+
+      static double length(double lat)
+      {
+	return x_scale * interpolate(lengths, false, lat).first;
+      }
+
+      static std::pair<double, double> height(double lat)
+      {
+	auto [value, slope] = interpolate(heights, true, lat);
+	return { lat < 0 ? -y_scale * value : y_scale * value, y_scale * slope };
+      }
+    };
+
+    // Šavrič, Jenny, Patterson, Petrovič and Hurni's polynomial version.
+    struct natural_earth : pseudocylindrical<natural_earth>
+    {
+      static constexpr std::string_view name = "natural-earth";
+
+      natural_earth(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	double x_max = std::numbers::pi * length(0);
+	double y_max = height(std::numbers::pi * 0.5).first;
+	return { -x_max, x_max, -y_max, y_max };
+      }
+
+      static double length(double lat)
+      {
+	double p2 = lat * lat;
+	double p4 = p2 * p2;
+	return 0.870700 - 0.131979 * p2 + p4 * (-0.013791 + p4 * p2 * (0.003971 - 0.001529 * p2));
+      }
+
+      static std::pair<double, double> height(double lat)
+      {
+	double p2 = lat * lat;
+	double p6 = p2 * p2 * p2;
+	return {
+	  lat * (1.007226 + 0.015085 * p2 + p6 * (-0.044475 + 0.028874 * p2 - 0.005916 * p2 * p2)),
+	  1.007226 + 3 * 0.015085 * p2 + p6 * (-7 * 0.044475 + 9 * 0.028874 * p2 - 11 * 0.005916 * p2 * p2)
+	};
+      }
+    };
+
+    // The arithmetic mean of equirectangular, with standard parallels at
+    // acos(2 / pi), and Aitoff.
+    struct winkel_tripel : iterative<winkel_tripel>
+    {
+      static constexpr std::string_view name = "winkel-tripel";
+      static constexpr double cos_standard_latitude = 2 / std::numbers::pi;
+
+      winkel_tripel(projection_parameters const &) { }
+
+      viewport bounds() const
+      {
+	return { -1 - std::numbers::pi * 0.5, 1 + std::numbers::pi * 0.5, -std::numbers::pi * 0.5, std::numbers::pi * 0.5 };
+      }
+
+      // With alpha = acos(cos(lat) cos(lon / 2)) and g = alpha / sin(alpha),
+      // x = (lon cos(lat1) + 2 cos(lat) sin(lon / 2) g) / 2 and
+      // y = (lat + sin(lat) g) / 2.  q is g' / sin(alpha), which tends to
+      // 1/3 at the centre.
+      forward_derivatives forward_jacobian(double lon, double lat) const
+      {
+	double sin_lat = std::sin(lat);
+	double cos_lat = std::cos(lat);
+	double sin_h = std::sin(lon * 0.5);
+	double cos_h = std::cos(lon * 0.5);
+	double cos_alpha = std::clamp(cos_lat * cos_h, -1.0, 1.0);
+	double alpha = std::acos(cos_alpha);
+	double sin_alpha = std::sqrt(1 - cos_alpha * cos_alpha);
+	double g = 1;
+	double q = 1.0 / 3;
+	if (alpha > 1e-4) {
+	  g = alpha / sin_alpha;
+	  q = (sin_alpha - alpha * cos_alpha) / (sin_alpha * sin_alpha * sin_alpha);
+	} else {
+	  g += alpha * alpha / 6;
+	  q += 2 * alpha * alpha / 15;
+	}
+	return forward_derivatives {
+	  point {
+	    0.5 * (lon * cos_standard_latitude + 2 * cos_lat * sin_h * g),
+	    0.5 * (lat + sin_lat * g)
+	  },
+	  0.5 * cos_standard_latitude + 0.5 * cos_lat * cos_h * g + 0.5 * q * cos_lat * cos_lat * sin_h * sin_h,
+	  sin_h * sin_lat * (q * cos_lat * cos_h - g),
+	  0.25 * q * sin_lat * cos_lat * sin_h,
+	  0.5 * (1 + cos_lat * g + q * sin_lat * sin_lat * cos_h)
+	};
+      }
+
+      point initial_guess(double x, double y) const
+      {
+	return point { x * std::numbers::pi / (1 + std::numbers::pi * 0.5), y };
+      }
+
+      // The edge is the meridian at 180 degrees, where
+      // y = (lat + pi / 2 sin(lat)) / 2 and x = 1 + pi / 2 cos(lat).
+      std::pair<double, double> x_domain(double y) const
+      {
+	double lat = solve_increasing([](double t) {
+	  return std::pair { 0.5 * (t + std::numbers::pi * 0.5 * std::sin(t)), 0.5 * (1 + std::numbers::pi * 0.5 * std::cos(t)) };
+	}, std::abs(y), 0, std::numbers::pi * 0.5);
+	if (std::isnan(lat))
+	  return empty_row;
+	double x = 1 + std::numbers::pi * 0.5 * std::cos(lat);
+	return { -x, x };
+      }
+    };
+
+    // Wagner VII, or Hammer-Wagner: Hammer's projection of a spherical cap
+    // up to 65 degrees of latitude and a third of the longitude.
+    struct wagner_7 : iterative<wagner_7>
+    {
+      static constexpr std::string_view name = "wagner-7";
+      static constexpr double sin_65 = 0.90630778703664996;
+      static constexpr double x_scale = 2.66723;
+      static constexpr double y_scale = 1.24104;
+
+      double y_max;
+
+      wagner_7(projection_parameters const &)
+	: y_max { forward_jacobian(std::numbers::pi, std::numbers::pi * 0.5).p.y }
+      {
+      }
+
+      viewport bounds() const
+      {
+	return { -x_scale, x_scale, -y_max, y_max };
+      }
+
+      forward_derivatives forward_jacobian(double lon, double lat) const
+      {
+	double a = lon / 3;
+	double sin_a = std::sin(a);
+	double cos_a = std::cos(a);
+	double s = sin_65 * std::sin(lat);
+	double ds = sin_65 * std::cos(lat);
+	double c0 = std::sqrt(1 - s * s);
+	double dc0 = -s * ds / c0;
+	double d = 1 + c0 * cos_a;
+	double c1 = std::sqrt(2 / d);
+	double dc1_dlat = -c1 / (2 * d) * dc0 * cos_a;
+	double dc1_da = c1 / (2 * d) * c0 * sin_a;
+	return forward_derivatives {
+	  point { x_scale * c0 * c1 * sin_a, y_scale * s * c1 },
+	  x_scale * c0 * (dc1_da * sin_a + c1 * cos_a) / 3,
+	  x_scale * sin_a * (dc0 * c1 + c0 * dc1_dlat),
+	  y_scale * s * dc1_da / 3,
+	  y_scale * (ds * c1 + s * dc1_dlat)
+	};
+      }
+
+      // The longitude is the fraction of the row's width, and the latitude
+      // the one at that longitude's meridian; the pole line bulges so much
+      // that a guess from y / y_max alone can land beyond it.
+      point initial_guess(double x, double y) const
+      {
+	double edge = x_domain(y).second;
+	double lon = edge > 0 ? std::clamp(x / edge, -1.0, 1.0) * std::numbers::pi : 0;
+	double lat = solve_increasing([this, lon](double t) {
+	  forward_derivatives f = forward_jacobian(lon, t);
+	  return std::pair { f.p.y, f.dy_dlat };
+	}, std::abs(y), 0, std::numbers::pi * 0.5);
+	if (std::isnan(lat))
+	  lat = std::numbers::pi * 0.5;
+	return point { lon, y < 0 ? -lat : lat };
+      }
+
+      // The pole lines are curved, so rows near them have a gap in the
+      // middle.  On a pole line c0 = cos(65), and with u = cos(lon / 3),
+      // x^2 (1 + c0 u) = 2 (x_scale c0)^2 (1 - u^2) is quadratic in u.
+      bool beyond_poles(double x, double y) const
+      {
+	double constexpr c0 = 0.42261826174069944;
+	double k = 2 * x_scale * x_scale * c0 * c0;
+	double x2 = x * x;
+	double u = (std::sqrt(x2 * x2 * c0 * c0 + 4 * k * (k - x2)) - x2 * c0) / (2 * k);
+	return u >= 0.5 && std::abs(y) > y_scale * sin_65 * std::sqrt(2 / (1 + c0 * u));
+      }
+
+      // The widest point of a row is on the meridian at 180 degrees.
+      std::pair<double, double> x_domain(double y) const
+      {
+	double lat = solve_increasing([this](double t) {
+	  forward_derivatives f = forward_jacobian(std::numbers::pi, t);
+	  return std::pair { f.p.y, f.dy_dlat };
+	}, std::abs(y), 0, std::numbers::pi * 0.5);
+	if (std::isnan(lat))
+	  return empty_row;
+	double x = forward_jacobian(std::numbers::pi, lat).p.x;
+	return { -x, x };
+      }
+    };
+
+    template <typename Policy>
+    concept has_fast_row = requires (Policy const & policy) { policy.fast_row(0.0); };
+
+    template <typename Policy>
+    concept has_x_domain = requires (Policy const & policy) { policy.x_domain(0.0); };
+
+    template <typename Policy>
+    concept has_forward = requires (Policy const & policy) { policy.forward(0.0, 0.0); };
+
+    template <typename Policy>
+    concept has_invert_statistics = requires (Policy const & policy, std::span<double const> xs, std::span<point> out) { policy.invert_statistics(xs, 0.0, out); };
+
+    template <bool Fast, typename Policy>
+    auto row(Policy const & policy, double y)
+    {
+      if constexpr (Fast && has_fast_row<Policy>)
+	return policy.fast_row(y);
+      else
+	return policy.row(y);
+    }
+
+    template <typename Policy>
+    concept has_unit_row = requires (Policy const & policy) { policy.unit_row(0.0); };
+
+    template <bool Fast, typename Policy>
+    MKWORLDMAP_MULTIVERSION
+    void invert_row(Policy const & policy, std::span<double const> xs, double y, std::span<point> out)
+    {
+      auto inverse = row<Fast>(policy, y);
+      for (std::size_t i = 0; i < xs.size(); ++i)
+	out[i] = inverse(xs[i]);
+    }
+
+    // The inverse of an oblique aspect, turned in the same pixel loop.
+    // Points on the unit sphere are turned as they are; other points go
+    // there and back through their longitude and latitude.
+    template <bool Fast, typename Policy>
+    auto rotated_row(Policy const & policy, sphere_rotation const & turn, double y)
+    {
+      if constexpr (has_unit_row<Policy>)
+	return [inverse = policy.unit_row(y), &turn](double x) mutable { return turn.to_globe<Fast>(inverse(x)); };
+      else
+	return [inverse = row<Fast>(policy, y), &turn](double x) mutable { return turn.to_globe<Fast>(inverse(x)); };
+    }
+
+    template <bool Fast, typename Policy>
+    MKWORLDMAP_MULTIVERSION
+    void invert_rotated_row(Policy const & policy, sphere_rotation const & turn, std::span<double const> xs, double y, std::span<point> out)
+    {
+      auto inverse = rotated_row<Fast>(policy, turn, y);
+      for (std::size_t i = 0; i < xs.size(); ++i)
+	out[i] = inverse(xs[i]);
+    }
+
+    template <typename Policy, bool Fast>
+    class policy_projection : public projection
+    {
+      Policy policy;
+      std::optional<sphere_rotation> turn;
+
+    public:
+      policy_projection() = delete;
+      policy_projection(policy_projection const &) = default;
+      policy_projection(policy_projection &&) = default;
+      policy_projection & operator=(policy_projection const &) = default;
+      policy_projection & operator=(policy_projection &&) = default;
+
+      policy_projection(Policy const & policy_, projection_parameters const & parameters)
+	: projection { policy_.bounds().x_min, policy_.bounds().x_max, policy_.bounds().y_min, policy_.bounds().y_max },
+	  policy { policy_ },
+	  turn { oblique_aspect(parameters) }
+      {
+      }
+
+      point invert(double x, double y) const override
+      {
+	if (turn)
+	  return rotated_row<Fast>(policy, *turn, y)(x);
+	return row<Fast>(policy, y)(x);
+      }
+
+      void invert_many(std::span<double const> xs, double y, std::span<point> out) const override
+      {
+	if (turn)
+	  invert_rotated_row<Fast>(policy, *turn, xs, y, out);
+	else
+	  invert_row<Fast>(policy, xs, y, out);
+      }
+
+      point forward(double lon, double lat) const override
+      {
+	if constexpr (has_forward<Policy>) {
+	  if (turn) {
+	    point p = turn->from_globe(lon, lat);
+	    return policy.forward(p.x, p.y);
+	  }
+	  return policy.forward(lon, lat);
+	} else {
+	  return projection::forward(lon, lat);
+	}
+      }
+
+      inverse_statistics invert_statistics(std::span<double const> xs, double y, std::span<point> out) const override
+      {
+	if constexpr (has_invert_statistics<Policy>) {
+	  inverse_statistics statistics = policy.invert_statistics(xs, y, out);
+	  if (turn)
+	    for (point & p : out)
+	      p = turn->to_globe<Fast>(p);
+	  return statistics;
+	} else {
+	  return projection::invert_statistics(xs, y, out);
+	}
+      }
+
+      bool separable() const override
+      {
+	return Policy::separable && !turn;
+      }
+
+      bool fast_math() const override
+      {
+	return Fast;
+      }
+
+      std::pair<double, double> x_domain(double y) const override
+      {
+	if constexpr (has_x_domain<Policy>)
+	  return policy.x_domain(y);
+	else
+	  return projection::x_domain(y);
+      }
+    };
+
+    template <typename... Policies>
+    struct projection_registry
+    {
+      static constexpr std::array<std::string_view, sizeof...(Policies)> names { Policies::name... };
+
+      static constexpr bool unique_names()
+      {
+	for (std::size_t i = 0; i < names.size(); ++i)
+	  for (std::size_t j = i + 1; j < names.size(); ++j)
+	    if (names[i] == names[j])
+	      return false;
+	return true;
+      }
+
+      template <typename Policy>
+      static std::unique_ptr<projection> make(projection_parameters const & parameters)
+      {
+	if (parameters.fast_math && (has_fast_row<Policy> || oblique_aspect(parameters)))
+	  return std::make_unique<policy_projection<Policy, true>>(Policy { parameters }, parameters);
+	return std::make_unique<policy_projection<Policy, false>>(Policy { parameters }, parameters);
+      }
+
+      static std::unique_ptr<projection> make(std::string_view name, projection_parameters const & parameters)
+      {
+	std::unique_ptr<projection> proj;
+	((name == Policies::name && (proj = make<Policies>(parameters), true)) || ...);
+	return proj;
+      }
+    };
+
+    // Adding a projection means writing its policy above and listing it here.
+    using registry = projection_registry<
+      equirectangular,
+      cylindrical_equal_area,
+      mercator,
+      miller,
+      central_cylindrical,
+      sinusoidal,
+      mollweide,
+      azimuthal_equidistant,
+      aitoff,
+      orthographic,
+      orthographic_aitoff,
+      lambert_azimuthal_equal_area,
+      hammer,
+      gall_stereographic,
+      eckert_1,
+      eckert_2,
+      eckert_3,
+      eckert_4,
+      eckert_5,
+      eckert_6,
+      collignon,
+      robinson,
+      natural_earth,
+      winkel_tripel,
+      wagner_7>;
+
+    static_assert(registry::unique_names(), "projection names must be unique");
   }
 
-  double collignon_shrink_factor(double y)
+  std::unique_ptr<projection> make_projection(std::string_view name, projection_parameters const & parameters)
   {
-    double s = 1 - y / std::sqrt(std::numbers::pi);
-    return 2 * s / std::sqrt(std::numbers::pi);
+    return registry::make(name, parameters);
   }
 
-  double collignon_invert_height(double y)
+  std::span<std::string_view const> projection_names()
   {
-    double s = 1 - y / std::sqrt(std::numbers::pi);
-    return std::asin(1 - s * s);
+    return registry::names;
   }
-  
-  point collignon_invert(double x, double y)
+
+  // Samples a lattice over the projection and keeps the points whose
+  // inverse falls in the box, padded by a lattice cell.  A box smaller
+  // than a cell can fall between samples, so when none is found the
+  // lattice is sampled again over the few cells around the sample nearest
+  // the box's centre, until the box is found or the cells stop shrinking.
+  viewport bounding_viewport(projection const & proj, double lon_min, double lon_max, double lat_min, double lat_max, double standard_longitude)
   {
-    return cylindrical_projection_invert(x, y, collignon_shrink_factor, collignon_invert_height);
+    std::size_t constexpr samples = 512;
+    std::size_t constexpr refinements = 8;
+    double nan = std::nan("");
+    double lon_span = lon_max - lon_min;
+    if (lon_span < 0)
+      lon_span += 2 * std::numbers::pi;
+    double center_lon = lon_min + lon_span / 2;
+    double center_lat = (lat_min + lat_max) / 2;
+
+    viewport window = proj.bounds();
+    for (std::size_t round = 0; round <= refinements; ++round) {
+      double cell_width = window.width() / samples;
+      double cell_height = window.height() / samples;
+      viewport view { nan, nan, nan, nan };
+      point nearest { nan, nan };
+      double nearest_cosine = -2;
+      for (std::size_t j = 0; j <= samples; ++j) {
+	double y = window.y_min + j * cell_height;
+	for (std::size_t i = 0; i <= samples; ++i) {
+	  double x = window.x_min + i * cell_width;
+	  point p = proj.invert(x, y);
+	  if (std::isnan(p.x) || std::isnan(p.y))
+	    continue;
+	  double lon = std::remainder(p.x + standard_longitude, 2 * std::numbers::pi);
+	  double cosine = std::sin(p.y) * std::sin(center_lat) + std::cos(p.y) * std::cos(center_lat) * std::cos(lon - center_lon);
+	  if (cosine > nearest_cosine) {
+	    nearest_cosine = cosine;
+	    nearest = point { x, y };
+	  }
+	  bool inside_longitude = lon_min <= lon_max
+	    ? lon >= lon_min && lon <= lon_max
+	    : lon >= lon_min || lon <= lon_max;
+	  if (!inside_longitude || p.y < lat_min || p.y > lat_max)
+	    continue;
+	  view.x_min = std::isnan(view.x_min) ? x : std::min(view.x_min, x);
+	  view.x_max = std::isnan(view.x_max) ? x : std::max(view.x_max, x);
+	  view.y_min = std::isnan(view.y_min) ? y : std::min(view.y_min, y);
+	  view.y_max = std::isnan(view.y_max) ? y : std::max(view.y_max, y);
+	}
+      }
+      if (!std::isnan(view.x_min))
+	return viewport {
+	  std::max(view.x_min - cell_width, proj.x_min),
+	  std::min(view.x_max + cell_width, proj.x_max),
+	  std::max(view.y_min - cell_height, proj.y_min),
+	  std::min(view.y_max + cell_height, proj.y_max)
+	};
+      if (std::isnan(nearest.x))
+	break;
+      window = viewport {
+	std::max(nearest.x - 2 * cell_width, proj.x_min),
+	std::min(nearest.x + 2 * cell_width, proj.x_max),
+	std::max(nearest.y - 2 * cell_height, proj.y_min),
+	std::min(nearest.y + 2 * cell_height, proj.y_max)
+      };
+      if (!(window.width() > 0 && window.height() > 0))
+	break;
+    }
+    return viewport { nan, nan, nan, nan };
   }
 }
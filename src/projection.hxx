@@ -1,37 +1,38 @@
 #ifndef MKWORLDMAP_PROJECTION_HXX_2024_03_18_K7DXVLGVC2LT
 #define MKWORLDMAP_PROJECTION_HXX_2024_03_18_K7DXVLGVC2LT
 
+#include <cmath>
+#include <cstddef>
 #include <memory>
+#include <numbers>
+#include <span>
+#include <string_view>
+#include <utility>
 
 #include "util.hxx"
 
 namespace mkworldmap
 {
   
-  enum class projection_method
+  struct viewport
   {
-    equirectangular,
-    cylindrical_equal_area,
-    mercator,
-    miller,
-    central_cylindrical,
-    sinusoidal,
-    mollweide,
-    azimuthal_equidistant,
-    aitoff,
-    orthographic,
-    orthographic_aitoff,
-    lambert_azimuthal_equal_area,
-    hammer,
-    gall_stereographic,
-    eckert_1,
-    eckert_2,
-    eckert_3,
-    eckert_4,
-    eckert_5,
-    eckert_6,
-    collignon,
-    invalid
+    double x_min;
+    double x_max;
+    double y_min;
+    double y_max;
+
+    double width() const;
+    double height() const;
+  };
+
+  // How an iterative inverse converged over some pixels.  Projections
+  // with a closed-form inverse report no solves.
+  struct inverse_statistics
+  {
+    std::size_t solves = 0;
+    std::size_t iterations = 0;
+    std::size_t max_iterations = 0;
+    std::size_t failures = 0;
   };
 
   class projection
@@ -49,31 +50,45 @@ namespace mkworldmap
     projection & operator=(projection const &) = default;
     projection & operator=(projection &&) = default;
     projection(double, double, double, double);
+    virtual ~projection() = default;
 
     double width() const;
     double height() const;
+    viewport bounds() const;
 
     virtual point invert(double, double) const = 0;
+    virtual void invert_many(std::span<double const>, double, std::span<point>) const;
+    // Maps a longitude and latitude to x and y, or to NaN when the
+    // projection has no forward formula.
+    virtual point forward(double, double) const;
+    // Same as invert_many, also counting the work of an iterative inverse.
+    virtual inverse_statistics invert_statistics(std::span<double const>, double, std::span<point>) const;
+    virtual bool separable() const;
+    virtual bool fast_math() const;
+    // An interval of x containing every point of row y that inverts to a
+    // point on the map, up to rounding.  Defaults to the whole line.
+    virtual std::pair<double, double> x_domain(double) const;
   };
 
-  class singleton_projection : public projection
+  struct projection_parameters
   {
-
-    point (*inverter)(double, double);
-  public:
-    singleton_projection() = delete;
-    singleton_projection(singleton_projection const &) = default;
-    singleton_projection(singleton_projection &&) = default;
-    singleton_projection & operator=(singleton_projection const &) = default;
-    singleton_projection & operator=(singleton_projection &&) = default;
-    singleton_projection(double, double, double, double, point (*)(double, double));
-
-    point invert(double, double) const override;
+    double standard_latitude = 0;
+    double max_latitude = 80 * std::numbers::pi / 180;
+    // The oblique aspect: the latitude shown at the centre of the map, and
+    // a counterclockwise turn of the globe about the centre.  The centre's
+    // longitude is the standard longitude, applied after inversion.
+    double center_latitude = 0;
+    double rotation = 0;
+    // Uses fast_row where the projection has one.  Check the result with
+    // image_creator::max_texel_difference before relying on it.
+    bool fast_math = false;
   };
 
-  point cylindrical_projection_invert(double, double, double (*)(double), double (*)(double));
-    
-  std::unique_ptr<projection> make_singleton_projection(projection_method);
+  // Returns nullptr when no projection is registered under the name.
+  std::unique_ptr<projection> make_projection(std::string_view, projection_parameters const & = { });
+  std::span<std::string_view const> projection_names();
+
+  viewport bounding_viewport(projection const &, double, double, double, double, double);
 
   constexpr double gudermann(double x)
   {
@@ -85,161 +100,6 @@ namespace mkworldmap
     return std::atanh(std::sin(x));
   }
 
-  double constexpr equirectangular_x_min = -std::numbers::pi;
-  double constexpr equirectangular_x_max = std::numbers::pi;
-  double constexpr equirectangular_y_min = -std::numbers::pi * 0.5;
-  double constexpr equirectangular_y_max = std::numbers::pi * 0.5;
-  point equirectangular_invert(double, double);
-
-  double constexpr miller_x_min = -std::numbers::pi;
-  double constexpr miller_x_max = std::numbers::pi;
-  double constexpr miller_y_min = -1.25 * inverse_gudermann(0.4 * std::numbers::pi);
-  double constexpr miller_y_max = 1.25 * inverse_gudermann(0.4 * std::numbers::pi);
-  point miller_invert(double, double);
-
-  double constexpr sinusoidal_x_min = -std::numbers::pi;
-  double constexpr sinusoidal_x_max = std::numbers::pi;
-  double constexpr sinusoidal_y_min = -std::numbers::pi * 0.5;
-  double constexpr sinusoidal_y_max = std::numbers::pi * 0.5;
-  point sinusoidal_invert(double, double);
-
-  double constexpr mollweide_parameter = 2 * std::sqrt(2) / std::numbers::pi;
-  double constexpr mollweide_x_min = -std::numbers::pi * mollweide_parameter;
-  double constexpr mollweide_x_max = std::numbers::pi * mollweide_parameter;
-  double constexpr mollweide_y_min = -4 / (mollweide_parameter * std::numbers::pi);
-  double constexpr mollweide_y_max = 4 / (mollweide_parameter * std::numbers::pi);
-  point mollweide_invert(double, double);
-
-  double constexpr azimuthal_equidistant_x_min = -std::numbers::pi;
-  double constexpr azimuthal_equidistant_x_max = std::numbers::pi;
-  double constexpr azimuthal_equidistant_y_min = -std::numbers::pi;
-  double constexpr azimuthal_equidistant_y_max = std::numbers::pi;
-  point azimuthal_equidistant_invert(double, double);
-
-  double constexpr aitoff_x_min = -std::numbers::pi;
-  double constexpr aitoff_x_max = std::numbers::pi;
-  double constexpr aitoff_y_min = -std::numbers::pi * 0.5;
-  double constexpr aitoff_y_max = std::numbers::pi * 0.5;
-  point aitoff_invert(double, double);
-
-  double constexpr orthographic_x_min = -1;
-  double constexpr orthographic_x_max = 1;
-  double constexpr orthographic_y_min = -1;
-  double constexpr orthographic_y_max = 1;
-  point orthographic_invert(double, double);
-
-  double constexpr orthographic_aitoff_x_min = -2;
-  double constexpr orthographic_aitoff_x_max = 2;
-  double constexpr orthographic_aitoff_y_min = -1;
-  double constexpr orthographic_aitoff_y_max = 1;
-  point orthographic_aitoff_invert(double, double);
-
-  double constexpr lambert_azimuthal_equal_area_x_min = -2;
-  double constexpr lambert_azimuthal_equal_area_x_max = 2;
-  double constexpr lambert_azimuthal_equal_area_y_min = -2;
-  double constexpr lambert_azimuthal_equal_area_y_max = 2;
-  point lambert_azimuthal_equal_area_invert(double, double);
-
-  double constexpr hammer_x_min = -2 * std::sqrt(2);
-  double constexpr hammer_x_max = 2 * std::sqrt(2);
-  double constexpr hammer_y_min = -std::sqrt(2);
-  double constexpr hammer_y_max = std::sqrt(2);
-  point hammer_invert(double, double);
-
-  double constexpr gall_stereographic_x_min = -std::numbers::pi;
-  double constexpr gall_stereographic_x_max = std::numbers::pi;
-  double constexpr gall_stereographic_y_min = -std::sqrt(2) - 1;
-  double constexpr gall_stereographic_y_max = std::sqrt(2) + 1;
-  point gall_stereographic_invert(double, double);
-
-  double constexpr eckert_1_x_min = -std::numbers::pi;
-  double constexpr eckert_1_x_max = std::numbers::pi;
-  double constexpr eckert_1_y_min = -std::numbers::pi * 0.5;
-  double constexpr eckert_1_y_max = std::numbers::pi * 0.5;
-  point eckert_1_invert(double, double);
-
-  double constexpr eckert_2_x_min = -2;
-  double constexpr eckert_2_x_max = 2;
-  double constexpr eckert_2_y_min = -1;
-  double constexpr eckert_2_y_max = 1;
-  point eckert_2_invert(double, double);
-
-  double constexpr eckert_3_x_min = -2 * std::numbers::pi;
-  double constexpr eckert_3_x_max = 2 * std::numbers::pi;
-  double constexpr eckert_3_y_min = -std::numbers::pi;
-  double constexpr eckert_3_y_max = std::numbers::pi;
-  point eckert_3_invert(double, double);
-
-  double constexpr eckert_4_x_min = -2 * std::numbers::pi;
-  double constexpr eckert_4_x_max = 2 * std::numbers::pi;
-  double constexpr eckert_4_y_min = -std::numbers::pi;
-  double constexpr eckert_4_y_max = std::numbers::pi;
-  point eckert_4_invert(double, double);
-
-  double constexpr eckert_5_x_min = -2 * std::numbers::pi;
-  double constexpr eckert_5_x_max = 2 * std::numbers::pi;
-  double constexpr eckert_5_y_min = -std::numbers::pi;
-  double constexpr eckert_5_y_max = std::numbers::pi;
-  point eckert_5_invert(double, double);
-
-  double constexpr eckert_6_x_min = -2 * std::numbers::pi;
-  double constexpr eckert_6_x_max = 2 * std::numbers::pi;
-  double constexpr eckert_6_y_min = -std::numbers::pi;
-  double constexpr eckert_6_y_max = std::numbers::pi;
-  point eckert_6_invert(double, double);
-
-  double constexpr collignon_x_min = -2 * std::sqrt(std::numbers::pi) * std::sqrt(2);
-  double constexpr collignon_x_max = 2 * std::sqrt(std::numbers::pi) * std::sqrt(2);
-  double constexpr collignon_y_min = std::sqrt(std::numbers::pi) * (1 - std::sqrt(2));
-  double constexpr collignon_y_max = std::sqrt(std::numbers::pi);
-  point collignon_invert(double, double);
-  
-  class cylindrical_equal_area_projection : public projection
-  {
-
-    double s_factor;
-    
-  public:
-    cylindrical_equal_area_projection();
-    cylindrical_equal_area_projection(cylindrical_equal_area_projection const &) = default;
-    cylindrical_equal_area_projection(cylindrical_equal_area_projection &&) = default;
-    cylindrical_equal_area_projection & operator=(cylindrical_equal_area_projection const &) = default;
-    cylindrical_equal_area_projection & operator=(cylindrical_equal_area_projection &&) = default;
-    cylindrical_equal_area_projection(double);
-    
-    point invert(double, double) const override;
-  };
-
-  class mercator_projection : public projection
-  {
-    double max_latitude;
-    
-  public:
-    mercator_projection() = delete;
-    mercator_projection(mercator_projection const &) = default;
-    mercator_projection(mercator_projection &&) = default;
-    mercator_projection & operator=(mercator_projection const &) = default;
-    mercator_projection & operator=(mercator_projection &&) = default;
-    mercator_projection(double);
-    
-    point invert(double, double) const override;
-  };
-
-  class central_cylindrical_projection : public projection
-  {
-    double max_latitude;
-    
-  public:
-    central_cylindrical_projection() = delete;
-    central_cylindrical_projection(central_cylindrical_projection const &) = default;
-    central_cylindrical_projection(central_cylindrical_projection &&) = default;
-    central_cylindrical_projection & operator=(central_cylindrical_projection const &) = default;
-    central_cylindrical_projection & operator=(central_cylindrical_projection &&) = default;
-    central_cylindrical_projection(double);
-    
-    point invert(double, double) const override;
-  };
-
 }
 
 #endif
@@ -0,0 +1,109 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "remap_table.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    struct remap_table_header
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t reserved;
+      std::uint64_t width;
+      std::uint64_t height;
+    };
+
+    char constexpr remap_table_magic[8] = { 'M', 'K', 'W', 'M', 'R', 'M', 'A', 'P' };
+    std::uint32_t constexpr remap_table_version = 2;
+  }
+
+  remap_table::remap_table(std::size_t width, std::size_t height)
+    : width { width },
+      height { height },
+      indices { std::make_shared<std::uint32_t[]>(width * height) }
+  {
+  }
+
+  remap_table remap_table::load(std::string const & path, std::size_t width, std::size_t height)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return remap_table { };
+    struct stat st;
+    std::size_t size = sizeof(remap_table_header) + width * height * sizeof(std::uint32_t);
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) != size) {
+      ::close(fd);
+      return remap_table { };
+    }
+    void * mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED)
+      return remap_table { };
+
+    remap_table_header header;
+    std::memcpy(&header, mapped, sizeof header);
+    if (std::memcmp(header.magic, remap_table_magic, sizeof header.magic) != 0
+	|| header.version != remap_table_version
+	|| header.width != width
+	|| header.height != height) {
+      ::munmap(mapped, size);
+      return remap_table { };
+    }
+
+    remap_table table;
+    table.width = width;
+    table.height = height;
+    table.indices = std::shared_ptr<std::uint32_t[]> {
+      reinterpret_cast<std::uint32_t *>(static_cast<char *>(mapped) + sizeof header),
+      [mapped, size](std::uint32_t *) { ::munmap(mapped, size); }
+    };
+    return table;
+  }
+
+  bool remap_table::save(std::string const & path) const
+  {
+    std::string temporary_path = path + ".tmp" + std::to_string(::getpid());
+    {
+      std::ofstream out { temporary_path, std::ios::binary };
+      remap_table_header header { };
+      std::memcpy(header.magic, remap_table_magic, sizeof header.magic);
+      header.version = remap_table_version;
+      header.width = width;
+      header.height = height;
+      out.write(reinterpret_cast<char const *>(&header), sizeof header);
+      out.write(reinterpret_cast<char const *>(indices.get()), width * height * sizeof(std::uint32_t));
+      if (!out) {
+	out.close();
+	std::remove(temporary_path.c_str());
+	return false;
+      }
+    }
+    return std::rename(temporary_path.c_str(), path.c_str()) == 0;
+  }
+
+  std::span<std::uint32_t> remap_table::row(std::size_t y)
+  {
+    return { indices.get() + y * width, width };
+  }
+
+  std::span<std::uint32_t const> remap_table::row(std::size_t y) const
+  {
+    return { indices.get() + y * width, width };
+  }
+
+  remap_table::operator bool() const
+  {
+    return static_cast<bool>(indices);
+  }
+
+}
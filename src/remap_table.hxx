@@ -0,0 +1,38 @@
+#ifndef MKWORLDMAP_REMAP_TABLE_HXX_2026_10_17_QH3VZP7M1XDA
+#define MKWORLDMAP_REMAP_TABLE_HXX_2026_10_17_QH3VZP7M1XDA
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+
+namespace mkworldmap
+{
+  class remap_table
+  {
+    std::size_t width;
+    std::size_t height;
+    std::shared_ptr<std::uint32_t[]> indices;
+
+  public:
+
+    static std::uint32_t constexpr background = 0xffffffff;
+
+    remap_table() = default;
+    remap_table(remap_table const &) = default;
+    remap_table(remap_table &&) = default;
+    remap_table & operator=(remap_table const &) = default;
+    remap_table & operator=(remap_table &&) = default;
+    remap_table(std::size_t, std::size_t);
+
+    static remap_table load(std::string const &, std::size_t, std::size_t);
+    bool save(std::string const &) const;
+
+    std::span<std::uint32_t> row(std::size_t);
+    std::span<std::uint32_t const> row(std::size_t) const;
+
+    explicit operator bool() const;
+  };
+}
+
+#endif
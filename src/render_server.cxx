@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "render_server.hxx"
+
+namespace mkworldmap
+{
+
+  namespace
+  {
+    std::size_t constexpr max_request_size = 64 * 1024;
+    int constexpr poll_milliseconds = 200;
+    int constexpr receive_timeout_seconds = 30;
+
+    volatile std::sig_atomic_t stop_requested = 0;
+
+    void request_stop(int)
+    {
+      stop_requested = 1;
+    }
+
+    bool make_address(std::string const & path, sockaddr_un & address)
+    {
+      address = sockaddr_un { };
+      address.sun_family = AF_UNIX;
+      if (path.empty() || path.size() >= sizeof address.sun_path)
+	return false;
+      std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+      return true;
+    }
+
+    int listen_on(std::string const & path)
+    {
+      sockaddr_un address;
+      if (!make_address(path, address))
+	return -1;
+      int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd < 0)
+	return -1;
+      ::unlink(path.c_str());
+      if (::bind(fd, reinterpret_cast<sockaddr const *>(&address), sizeof address) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+	::close(fd);
+	return -1;
+      }
+      return fd;
+    }
+
+    int connect_to(std::string const & path)
+    {
+      sockaddr_un address;
+      if (!make_address(path, address))
+	return -1;
+      int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd < 0)
+	return -1;
+      if (::connect(fd, reinterpret_cast<sockaddr const *>(&address), sizeof address) != 0) {
+	::close(fd);
+	return -1;
+      }
+      return fd;
+    }
+
+    bool send_all(int fd, char const * data, std::size_t size)
+    {
+      while (size > 0) {
+	ssize_t sent = ::send(fd, data, size, MSG_NOSIGNAL);
+	if (sent < 0 && errno == EINTR)
+	  continue;
+	if (sent <= 0)
+	  return false;
+	data += sent;
+	size -= sent;
+      }
+      return true;
+    }
+
+    bool send_all(int fd, std::string const & data)
+    {
+      return send_all(fd, data.data(), data.size());
+    }
+
+    // Reads up to the first newline; whatever arrived after it is left in
+    // rest.
+    bool read_line(int fd, std::string & line, std::string & rest)
+    {
+      line.clear();
+      char buffer[4096];
+      for (;;) {
+	ssize_t received = ::recv(fd, buffer, sizeof buffer, 0);
+	if (received < 0 && errno == EINTR)
+	  continue;
+	if (received <= 0)
+	  return false;
+	line.append(buffer, received);
+	if (std::size_t end = line.find('\n'); end != std::string::npos) {
+	  rest = line.substr(end + 1);
+	  line.resize(end);
+	  return true;
+	}
+	if (line.size() > max_request_size)
+	  return false;
+      }
+    }
+  }
+
+  render_server::render_server(render_function render, key_function key_of, server_options const & options)
+    : render { std::move(render) },
+      key_of { std::move(key_of) },
+      options { options }
+  {
+    this->options.workers = std::max<std::size_t>(this->options.workers, 1);
+    this->options.max_connections = std::max<std::size_t>(this->options.max_connections, 1);
+  }
+
+  render_server::image render_server::cached(std::string const & key)
+  {
+    auto found = cache_index.find(key);
+    if (found == cache_index.end())
+      return nullptr;
+    cache.splice(cache.begin(), cache, found->second);
+    return found->second->second;
+  }
+
+  void render_server::store(std::string const & key, image const & result)
+  {
+    if (result->size() > options.cache_bytes || cache_index.contains(key))
+      return;
+    cache.emplace_front(key, result);
+    cache_index.emplace(key, cache.begin());
+    cache_size += result->size();
+    while (cache_size > options.cache_bytes) {
+      cache_size -= cache.back().second->size();
+      cache_index.erase(cache.back().first);
+      cache.pop_back();
+    }
+  }
+
+  void render_server::work()
+  {
+    for (;;) {
+      std::shared_ptr<job> next;
+      {
+	std::unique_lock<std::mutex> lock { mutex };
+	jobs_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+	if (queue.empty())
+	  return;
+	next = std::move(queue.front());
+	queue.pop_front();
+	++running;
+      }
+      // A request that throws, say bad_alloc for a huge image, fails alone
+      // rather than taking the server and its waiters down with it.
+      image result;
+      try {
+	std::string bytes;
+	if (render(next->args, bytes))
+	  result = std::make_shared<std::string const>(std::move(bytes));
+      } catch (std::exception const & e) {
+	std::cerr << "ERROR: a render failed: " << e.what() << std::endl;
+      }
+      {
+	std::lock_guard<std::mutex> lock { mutex };
+	--running;
+	in_flight.erase(next->key);
+	if (result)
+	  store(next->key, result);
+      }
+      next->result.set_value(result);
+    }
+  }
+
+  void render_server::handle(int fd)
+  {
+    auto start = std::chrono::steady_clock::now();
+    timeval timeout { receive_timeout_seconds, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    std::size_t number;
+    {
+      std::lock_guard<std::mutex> lock { mutex };
+      number = ++requests;
+    }
+    auto elapsed = [&start] {
+      return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::string line, rest;
+    arguments args { "mkworldmap" };
+    if (read_line(fd, line, rest)) {
+      std::istringstream tokens { line };
+      for (std::string token; tokens >> token; )
+	args.push_back(token);
+    }
+    if (args.size() == 1) {
+      send_all(fd, "ERROR empty request\n");
+      log(number, "error", 0, elapsed());
+      return;
+    }
+
+    std::string key = key_of(args);
+    image result;
+    std::shared_future<image> pending;
+    char const * status;
+    {
+      std::lock_guard<std::mutex> lock { mutex };
+      if ((result = cached(key))) {
+	status = "hit";
+      } else if (auto found = in_flight.find(key); found != in_flight.end()) {
+	pending = found->second;
+	status = "joined";
+      } else if (stopping || queue.size() + running >= options.workers + options.queue_depth) {
+	status = "busy";
+      } else {
+	auto next = std::make_shared<job>();
+	next->key = key;
+	next->args = std::move(args);
+	pending = next->result.get_future().share();
+	in_flight.emplace(key, pending);
+	queue.push_back(std::move(next));
+	jobs_ready.notify_one();
+	status = "miss";
+      }
+    }
+    if (pending.valid())
+      result = pending.get();
+
+    if (result) {
+      send_all(fd, "OK " + std::to_string(result->size()) + "\n") && send_all(fd, *result);
+    } else if (std::strcmp(status, "busy") == 0) {
+      send_all(fd, "BUSY\n");
+    } else {
+      status = "error";
+      send_all(fd, "ERROR render failed\n");
+    }
+    log(number, status, result ? result->size() : 0, elapsed());
+  }
+
+  void render_server::log(std::size_t number, char const * status, std::size_t bytes, double milliseconds)
+  {
+    std::lock_guard<std::mutex> lock { log_mutex };
+    std::cout << "request " << number
+	      << '\t' << status
+	      << '\t' << bytes << " bytes"
+	      << '\t' << milliseconds << " ms" << std::endl;
+  }
+
+  bool render_server::serve(std::string const & socket_path)
+  {
+    int listener = listen_on(socket_path);
+    if (listener < 0)
+      return false;
+
+    stop_requested = 0;
+    struct sigaction action { };
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    struct sigaction previous_interrupt, previous_terminate;
+    ::sigaction(SIGINT, &action, &previous_interrupt);
+    ::sigaction(SIGTERM, &action, &previous_terminate);
+
+    std::vector<std::jthread> workers;
+    for (std::size_t w = 0; w < options.workers; ++w)
+      workers.emplace_back([this] { work(); });
+
+    while (!stop_requested) {
+      pollfd listening { listener, POLLIN, 0 };
+      if (::poll(&listening, 1, poll_milliseconds) <= 0)
+	continue;
+      int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0)
+	continue;
+      {
+	std::lock_guard<std::mutex> lock { mutex };
+	if (connections >= options.max_connections) {
+	  send_all(client, "BUSY\n");
+	  ::close(client);
+	  continue;
+	}
+	++connections;
+      }
+      std::thread { [this, client] {
+	handle(client);
+	::close(client);
+	std::lock_guard<std::mutex> lock { mutex };
+	--connections;
+	connections_done.notify_all();
+      } }.detach();
+    }
+
+    ::close(listener);
+    ::unlink(socket_path.c_str());
+    {
+      std::lock_guard<std::mutex> lock { mutex };
+      stopping = true;
+    }
+    jobs_ready.notify_all();
+    workers.clear();
+    {
+      std::unique_lock<std::mutex> lock { mutex };
+      connections_done.wait(lock, [this] { return connections == 0; });
+    }
+    ::sigaction(SIGINT, &previous_interrupt, nullptr);
+    ::sigaction(SIGTERM, &previous_terminate, nullptr);
+    return true;
+  }
+
+  bool request_render(std::string const & socket_path, std::string const & request, std::string & image, std::string & error)
+  {
+    int fd = connect_to(socket_path);
+    if (fd < 0) {
+      error = "failed to connect to the server";
+      return false;
+    }
+    std::string header;
+    bool received = send_all(fd, request + "\n") && ::shutdown(fd, SHUT_WR) == 0 && read_line(fd, header, image);
+    if (received && header.starts_with("OK ")) {
+      std::size_t size = std::stoull(header.substr(3));
+      char buffer[65536];
+      while (image.size() < size) {
+	ssize_t count = ::recv(fd, buffer, sizeof buffer, 0);
+	if (count < 0 && errno == EINTR)
+	  continue;
+	if (count <= 0)
+	  break;
+	image.append(buffer, count);
+      }
+      ::close(fd);
+      if (image.size() != size) {
+	error = "the reply was cut short";
+	return false;
+      }
+      return true;
+    }
+    ::close(fd);
+    if (!received)
+      error = "no reply from the server";
+    else if (header == "BUSY")
+      error = "the server is busy";
+    else if (header.starts_with("ERROR "))
+      error = header.substr(6);
+    else
+      error = "malformed reply";
+    return false;
+  }
+
+}
@@ -0,0 +1,90 @@
+#ifndef MKWORLDMAP_RENDER_SERVER_HXX_2026_10_17_Q7HV3MZP5XWD
+#define MKWORLDMAP_RENDER_SERVER_HXX_2026_10_17_Q7HV3MZP5XWD
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace mkworldmap
+{
+  // workers render jobs; at most queue_depth more wait for one.  Encoded
+  // images are kept until they use more than cache_bytes.
+  struct server_options
+  {
+    std::size_t workers = 1;
+    std::size_t queue_depth = 16;
+    std::size_t cache_bytes = std::size_t { 256 } << 20;
+    std::size_t max_connections = 64;
+  };
+
+  // Serves renders over a Unix socket.  A request is one line of command
+  // line options; the reply is "OK <size>\n" and the encoded image,
+  // "BUSY\n" when the queue is full, or "ERROR <message>\n".  Requests with
+  // the same key share one render and its cached result.
+  class render_server
+  {
+  public:
+    using arguments = std::vector<std::string>;
+    using render_function = std::function<bool(arguments const &, std::string &)>;
+    using key_function = std::function<std::string(arguments const &)>;
+
+  private:
+    using image = std::shared_ptr<std::string const>;
+
+    struct job
+    {
+      std::string key;
+      arguments args;
+      std::promise<image> result;
+    };
+
+    render_function render;
+    key_function key_of;
+    server_options options;
+
+    std::mutex mutex;
+    std::condition_variable jobs_ready;
+    std::condition_variable connections_done;
+    std::deque<std::shared_ptr<job>> queue;
+    std::unordered_map<std::string, std::shared_future<image>> in_flight;
+    std::list<std::pair<std::string, image>> cache;
+    std::unordered_map<std::string, std::list<std::pair<std::string, image>>::iterator> cache_index;
+    std::size_t cache_size = 0;
+    std::size_t running = 0;
+    std::size_t connections = 0;
+    std::size_t requests = 0;
+    bool stopping = false;
+    std::mutex log_mutex;
+
+    image cached(std::string const &);
+    void store(std::string const &, image const &);
+    void work();
+    void handle(int);
+    void log(std::size_t, char const *, std::size_t, double);
+
+  public:
+    render_server() = delete;
+    render_server(render_server const &) = delete;
+    render_server(render_server &&) = delete;
+    render_server & operator=(render_server const &) = delete;
+    render_server & operator=(render_server &&) = delete;
+    render_server(render_function, key_function, server_options const &);
+
+    // Runs until SIGINT or SIGTERM.
+    bool serve(std::string const & socket_path);
+  };
+
+  // Sends one request and receives the image; error is set when it fails.
+  bool request_render(std::string const & socket_path, std::string const & request, std::string & image, std::string & error);
+}
+
+#endif
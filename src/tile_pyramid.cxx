@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+
+#include "image_creator.hxx"
+#include "image_writer.hxx"
+#include "parallel.hxx"
+#include "tile_pyramid.hxx"
+
+namespace mkworldmap
+{
+
+  tile_pyramid::tile_pyramid(earth_texture const & texture, projection const & proj, std::string const & directory, std::size_t max_zoom, double sl, bool south_up, std::size_t threads)
+    : texture { texture },
+      proj { proj },
+      standard_longitude { sl },
+      south_up { south_up },
+      max_zoom { max_zoom },
+      threads { threads },
+      directory { directory }
+  {
+    double side = std::max(proj.width(), proj.height());
+    double x_center = (proj.x_min + proj.x_max) / 2;
+    double y_center = (proj.y_min + proj.y_max) / 2;
+    extent = viewport {
+      x_center - side / 2,
+      x_center + side / 2,
+      y_center - side / 2,
+      y_center + side / 2
+    };
+  }
+
+  void tile_pyramid::set_antialiasing(std::size_t samples)
+  {
+    antialiasing = samples;
+  }
+
+  viewport tile_pyramid::tile_viewport(std::size_t zoom, std::size_t x, std::size_t y) const
+  {
+    std::size_t count = std::size_t { 1 } << zoom;
+    if (south_up) {
+      x = count - x - 1;
+      y = count - y - 1;
+    }
+    double side = extent.width() / count;
+    return viewport {
+      extent.x_min + x * side,
+      extent.x_min + (x + 1) * side,
+      extent.y_max - (y + 1) * side,
+      extent.y_max - y * side
+    };
+  }
+
+  bool tile_pyramid::is_empty(viewport tile) const
+  {
+    if (tile.x_max < proj.x_min || tile.x_min > proj.x_max || tile.y_max < proj.y_min || tile.y_min > proj.y_max)
+      return true;
+    if (tile.x_min <= proj.x_min && tile.x_max >= proj.x_max && tile.y_min <= proj.y_min && tile.y_max >= proj.y_max)
+      return false;
+
+    double pixel = tile.width() / tile_size;
+    for (std::size_t i = 0; i < tile_size; ++i) {
+      double offset = (i + 0.5) * pixel;
+      point edges[] = {
+	proj.invert(tile.x_min + offset, tile.y_min + pixel / 2),
+	proj.invert(tile.x_min + offset, tile.y_max - pixel / 2),
+	proj.invert(tile.x_min + pixel / 2, tile.y_min + offset),
+	proj.invert(tile.x_max - pixel / 2, tile.y_min + offset)
+      };
+      for (point p : edges)
+	if (!std::isnan(p.x) && !std::isnan(p.y))
+	  return false;
+    }
+    return true;
+  }
+
+  tile_pyramid::tile_image tile_pyramid::render_tile(std::size_t x, std::size_t y) const
+  {
+    viewport tile = tile_viewport(max_zoom, x, y);
+    if (is_empty(tile))
+      return tile_image { };
+    double pixel = tile.width() / tile_size;
+    viewport centers {
+      tile.x_min + pixel / 2,
+      tile.x_max - pixel / 2,
+      tile.y_min + pixel / 2,
+      tile.y_max - pixel / 2
+    };
+    image_creator creator { texture, proj, centers, tile_size, tile_size, standard_longitude, south_up };
+    creator.set_antialiasing(antialiasing);
+    tile_image image = std::make_shared<char unsigned[]>(tile_size * tile_size * 3);
+    creator.render(image.get());
+    return image;
+  }
+
+  tile_pyramid::tile_image tile_pyramid::downsample(tile_image const (& children)[4]) const
+  {
+    if (std::none_of(std::begin(children), std::end(children), [](tile_image const & child) { return static_cast<bool>(child); }))
+      return tile_image { };
+    std::size_t half = tile_size / 2;
+    tile_image image = std::make_shared<char unsigned[]>(tile_size * tile_size * 3);
+    for (std::size_t y = 0; y < tile_size; ++y) {
+      for (std::size_t x = 0; x < tile_size; ++x) {
+	tile_image const & child = children[(y / half) * 2 + x / half];
+	std::size_t cx = (x % half) * 2;
+	std::size_t cy = (y % half) * 2;
+	for (std::size_t k = 0; k < 3; ++k) {
+	  unsigned sum = 0;
+	  for (std::size_t dy = 0; dy < 2; ++dy)
+	    for (std::size_t dx = 0; dx < 2; ++dx)
+	      sum += child ? child[((cy + dy) * tile_size + cx + dx) * 3 + k] : 0xaa;
+	  image[(y * tile_size + x) * 3 + k] = (sum + 2) / 4;
+	}
+      }
+    }
+    return image;
+  }
+
+  tile_pyramid::tile_image tile_pyramid::build(std::size_t zoom, std::size_t x, std::size_t y, bool & written) const
+  {
+    tile_image image;
+    if (zoom == max_zoom) {
+      image = render_tile(x, y);
+    } else {
+      tile_image children[4] = {
+	build(zoom + 1, 2 * x, 2 * y, written),
+	build(zoom + 1, 2 * x + 1, 2 * y, written),
+	build(zoom + 1, 2 * x, 2 * y + 1, written),
+	build(zoom + 1, 2 * x + 1, 2 * y + 1, written)
+      };
+      image = downsample(children);
+    }
+    written = write_tile(zoom, x, y, image) && written;
+    return image;
+  }
+
+  std::string tile_pyramid::tile_path(std::size_t zoom, std::size_t x, std::size_t y) const
+  {
+    return directory + '/' + std::to_string(zoom) + '/' + std::to_string(x) + '/' + std::to_string(y) + ".png";
+  }
+
+  bool tile_pyramid::write_tile(std::size_t zoom, std::size_t x, std::size_t y, tile_image const & image) const
+  {
+    std::filesystem::path path = tile_path(zoom, x, y);
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+    std::filesystem::remove(path, error);
+    if (!image) {
+      std::filesystem::create_hard_link(directory + "/background.png", path, error);
+      if (!error)
+	return true;
+      return std::filesystem::copy_file(directory + "/background.png", path, error);
+    }
+    std::unique_ptr<image_writer> writer = make_png_writer(path, tile_size, tile_size);
+    return writer && writer->write_rows(image.get(), tile_size) && writer->finish();
+  }
+
+  bool tile_pyramid::generate() const
+  {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    std::unique_ptr<image_writer> background_writer = make_png_writer(directory + "/background.png", tile_size, tile_size);
+    std::vector<char unsigned> background(tile_size * tile_size * 3, 0xaa);
+    if (!background_writer || !background_writer->write_rows(background.data(), tile_size) || !background_writer->finish())
+      return false;
+    background_writer.reset();
+
+    std::size_t split_zoom = 0;
+    while (split_zoom < max_zoom && (std::size_t { 1 } << (2 * split_zoom)) < 4 * threads)
+      ++split_zoom;
+    std::size_t split_count = std::size_t { 1 } << split_zoom;
+    std::vector<tile_image> split_tiles(split_count * split_count);
+    std::atomic<bool> failed = false;
+    parallel_for(split_tiles.size(), threads, [&](std::size_t i) {
+      bool written = true;
+      split_tiles[i] = build(split_zoom, i % split_count, i / split_count, written);
+      if (!written)
+	failed = true;
+    });
+    if (failed)
+      return false;
+
+    for (std::size_t zoom = split_zoom; zoom > 0; --zoom) {
+      std::size_t count = std::size_t { 1 } << (zoom - 1);
+      std::vector<tile_image> parents(count * count);
+      for (std::size_t y = 0; y < count; ++y) {
+	for (std::size_t x = 0; x < count; ++x) {
+	  tile_image children[4] = {
+	    split_tiles[(2 * y) * 2 * count + 2 * x],
+	    split_tiles[(2 * y) * 2 * count + 2 * x + 1],
+	    split_tiles[(2 * y + 1) * 2 * count + 2 * x],
+	    split_tiles[(2 * y + 1) * 2 * count + 2 * x + 1]
+	  };
+	  parents[y * count + x] = downsample(children);
+	  if (!write_tile(zoom - 1, x, y, parents[y * count + x]))
+	    return false;
+	}
+      }
+      split_tiles = std::move(parents);
+    }
+    return true;
+  }
+
+}
@@ -0,0 +1,52 @@
+#ifndef MKWORLDMAP_TILE_PYRAMID_HXX_2026_10_17_T4MKD8WQ2ZPL
+#define MKWORLDMAP_TILE_PYRAMID_HXX_2026_10_17_T4MKD8WQ2ZPL
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "earth_texture.hxx"
+#include "projection.hxx"
+
+namespace mkworldmap
+{
+  class tile_pyramid
+  {
+    using tile_image = std::shared_ptr<char unsigned[]>;
+
+    earth_texture const & texture;
+    projection const & proj;
+    double standard_longitude;
+    bool south_up;
+    std::size_t max_zoom;
+    std::size_t threads;
+    std::size_t antialiasing = 1;
+    std::string directory;
+    viewport extent;
+
+    viewport tile_viewport(std::size_t, std::size_t, std::size_t) const;
+    bool is_empty(viewport) const;
+    tile_image render_tile(std::size_t, std::size_t) const;
+    tile_image downsample(tile_image const (&)[4]) const;
+    tile_image build(std::size_t, std::size_t, std::size_t, bool &) const;
+    std::string tile_path(std::size_t, std::size_t, std::size_t) const;
+    bool write_tile(std::size_t, std::size_t, std::size_t, tile_image const &) const;
+
+  public:
+
+    static std::size_t constexpr tile_size = 256;
+
+    tile_pyramid() = delete;
+    tile_pyramid(tile_pyramid const &) = default;
+    tile_pyramid(tile_pyramid &&) = default;
+    tile_pyramid & operator=(tile_pyramid const &) = delete;
+    tile_pyramid & operator=(tile_pyramid &&) = delete;
+    tile_pyramid(earth_texture const &, projection const &, std::string const &, std::size_t, double, bool = false, std::size_t = 1);
+
+    void set_antialiasing(std::size_t);
+
+    bool generate() const;
+  };
+}
+
+#endif
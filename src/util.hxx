@@ -3,6 +3,15 @@
 
 #include <cmath>
 
+#if defined(__x86_64__) && defined(__has_attribute)
+#if __has_attribute(target_clones)
+#define MKWORLDMAP_MULTIVERSION __attribute__((target_clones("avx512f", "avx2", "default")))
+#endif
+#endif
+#ifndef MKWORLDMAP_MULTIVERSION
+#define MKWORLDMAP_MULTIVERSION
+#endif
+
 namespace mkworldmap
 {
   struct color